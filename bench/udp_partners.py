@@ -0,0 +1,188 @@
+"""Measures UDPServer receive overhead as the number of partners grows.
+
+Every simulated partner is a local UDP socket that streams a HEARTBEAT once per second, so the server keeps one
+`Connection` per socket alive. At each step a probe partner sends a burst of messages and the time until the server
+has counted all of them is reported per message. Every burst ends with a sentinel HEARTBEAT from another component
+of the probe, and the benchmark blocks in `Connection.receive()` until the server has parsed it, so the timing
+contains no polling of the benchmark's own.
+
+    python bench/udp_partners.py --partners 10000
+"""
+import argparse
+import resource
+import socket
+import struct
+import sys
+import threading
+import time
+sys.path.append('./cmake-build-debug')
+
+import libmav
+
+
+MESSAGES = '''<?xml version="1.0"?>
+<mavlink>
+    <messages>
+        <message id="0" name="HEARTBEAT">
+            <field type="uint8_t" name="type">Type</field>
+            <field type="uint8_t" name="autopilot">Autopilot</field>
+            <field type="uint8_t" name="base_mode">Base mode</field>
+            <field type="uint32_t" name="custom_mode">Custom mode</field>
+            <field type="uint8_t" name="system_status">System status</field>
+            <field type="uint8_t" name="mavlink_version">MAVLink version</field>
+        </message>
+    </messages>
+</mavlink>
+'''
+
+HEARTBEAT_CRC_EXTRA = 50
+
+
+def crc_accumulate(data, crc=0xFFFF):
+    for byte in data:
+        tmp = byte ^ (crc & 0xFF)
+        tmp = (tmp ^ (tmp << 4)) & 0xFF
+        crc = ((crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)) & 0xFFFF
+    return crc
+
+
+def heartbeat_frame(seq, system_id, component_id=1):
+    payload = struct.pack('<IBBBBB', 0, 2, 0, 0, 4, 3)
+    header = struct.pack('<BBBBBBB', len(payload), 0, 0, seq & 0xFF, system_id, component_id, 0) + b'\x00\x00'
+    crc = crc_accumulate(bytes([HEARTBEAT_CRC_EXTRA]), crc_accumulate(header + payload))
+    return b'\xfd' + header + payload + struct.pack('<H', crc)
+
+
+def wait_for(condition, timeout_s):
+    deadline = time.monotonic() + timeout_s
+    while not condition():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.01)
+    return True
+
+
+class Partners:
+    """Local UDP sockets that each keep a connection on the server alive."""
+
+    def __init__(self, port):
+        self._address = ('127.0.0.1', port)
+        self._sockets = []
+        self._lock = threading.Lock()
+        self._stop = threading.Event()
+        self._thread = threading.Thread(target=self._run, daemon=True)
+        self._thread.start()
+
+    def __len__(self):
+        with self._lock:
+            return len(self._sockets)
+
+    def add(self, count):
+        for _ in range(count):
+            sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+            sock.setblocking(False)
+            system_id = len(self._sockets) % 250 + 1
+            self._send(sock, system_id, 0)
+            with self._lock:
+                self._sockets.append((sock, system_id))
+
+    def _send(self, sock, system_id, seq):
+        try:
+            sock.sendto(heartbeat_frame(seq, system_id), self._address)
+        except BlockingIOError:
+            pass
+
+    def _run(self):
+        seq = 1
+        while not self._stop.wait(1.0):
+            with self._lock:
+                sockets = list(self._sockets)
+            for sock, system_id in sockets:
+                self._send(sock, system_id, seq)
+            seq += 1
+
+    def close(self):
+        self._stop.set()
+        self._thread.join()
+        for sock, _ in self._sockets:
+            sock.close()
+
+
+def measure(probe, probe_conn, port, messages, burst):
+    received = lambda: probe_conn.stats()['senders'].get((251, 1), {}).get('received', 0)
+    start_count = received()
+    seq = 0
+    start = time.perf_counter()
+    for sent in range(0, messages, burst):
+        for _ in range(min(burst, messages - sent)):
+            probe.sendto(heartbeat_frame(seq, 251), ('127.0.0.1', port))
+            seq += 1
+        # the sentinel is parsed after the burst, so waiting for it paces the bursts and the socket buffer
+        # never overflows
+        expectation = probe_conn.expect('HEARTBEAT', 251, 2)
+        probe.sendto(heartbeat_frame(sent // burst, 251, 2), ('127.0.0.1', port))
+        try:
+            probe_conn.receive(expectation, 5000)
+        except libmav.TimeoutException:
+            break
+    elapsed = time.perf_counter() - start
+    return elapsed, received() - start_count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--partners', type=int, default=10000, help='largest number of partners to simulate')
+    parser.add_argument('--messages', type=int, default=20000, help='probe messages per step')
+    parser.add_argument('--burst', type=int, default=200, help='probe messages sent before waiting for the server')
+    parser.add_argument('--port', type=int, default=14700)
+    args = parser.parse_args()
+
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    wanted = args.partners + 256
+    if soft < wanted and hard != soft:
+        soft = hard if hard == resource.RLIM_INFINITY else min(hard, wanted)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+    if soft != resource.RLIM_INFINITY and soft < wanted:
+        print(f'open file limit is {soft}, simulating at most {soft - 256} partners')
+        args.partners = soft - 256
+
+    message_set = libmav.MessageSet()
+    message_set.add_from_xml_string(MESSAGES)
+    heartbeat = message_set.create('HEARTBEAT').set_from_dict({
+        'type': 6, 'autopilot': 8, 'base_mode': 0, 'custom_mode': 0, 'system_status': 4, 'mavlink_version': 3
+    })
+    server_physical = libmav.UDPServer(args.port)
+    server_runtime = libmav.NetworkRuntime(message_set, heartbeat, server_physical)
+
+    connections = [0, 0]
+    server_runtime.on_connection(lambda conn: connections.__setitem__(0, connections[0] + 1))
+    server_runtime.on_connection_lost(lambda conn: connections.__setitem__(1, connections[1] + 1))
+    live = lambda: connections[0] - connections[1]
+
+    probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    probe.sendto(heartbeat_frame(0, 251), ('127.0.0.1', args.port))
+    probe_conn = server_runtime.await_connection(2000)
+    if probe_conn is None:
+        sys.exit('server did not see the probe partner')
+
+    partners = Partners(args.port)
+    print(f'{"partners":>9} {"live":>7} {"messages":>9} {"us/message":>11} {"messages/s":>11}')
+    step = 1
+    try:
+        while True:
+            step = min(step, args.partners)
+            partners.add(step - len(partners))
+            wait_for(lambda: live() >= step + 1, 10)
+            elapsed, received = measure(probe, probe_conn, args.port, args.messages, args.burst)
+            per_message = elapsed / received * 1e6 if received else float('nan')
+            print(f'{len(partners):>9} {live() - 1:>7} {received:>9} {per_message:>11.2f} {received / elapsed:>11.0f}')
+            if step == args.partners:
+                break
+            step *= 10
+    finally:
+        partners.close()
+        probe.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -41,6 +41,27 @@ class Connection():
     If don't want to poll, you can get get asynchronous notification when a connection is lost using `NetworkRuntime.on_connection_lost()`.
     """
 
+    def add_batch_callback(self, callbackFn, max_batch=64, max_latency_ms=10):
+        """Add a callback function that is called with a list of received messages.
+
+        Messages are collected in C++ and handed to python in one call, which takes the GIL once per batch
+        instead of once per message. Use this instead of `add_message_callback()` for high-rate streams.
+        The callback is called from a separate delivery thread as soon as `max_batch` messages are pending,
+        or `max_latency_ms` after the oldest pending message arrived, whichever comes first.
+
+        ```python
+        callback_handle = connection.add_batch_callback(lambda msgs: print(len(msgs)), 100, 20)
+        ```
+
+        A callback can be removed using `remove_message_callback()`. Messages that are still pending then are
+        delivered in one final, possibly partial, batch.
+
+        Args:
+            callbackFn (function): A callback function that takes a list of `Message` objects.
+            max_batch (int): Maximum number of messages per call.
+            max_latency_ms (int): Maximum time in milliseconds a message waits before it is delivered.
+        """
+
     def add_message_callback(self, callbackFn):
         """Add a callback function that is called whenever any message is received on the connection.
 
@@ -74,6 +95,48 @@ class Connection():
             exceptionFn (function): A callback function that takes an `Exception` argument. This is called if there is an exception in the message callback <!-- correct? -->
         """
 
+
+    def add_message_callback(self, callbackFn, executor, ordering='connection'):
+        """Add a callback function that runs on the worker threads of a `CallbackExecutor`.
+
+        The receive thread only hands the message to the executor, so a slow callback no longer stalls parsing
+        for every connection on the interface.
+        With `ordering='connection'`, all messages of the connection are delivered in order by the same worker.
+        With `ordering='message_id'`, only messages with the same id keep their order, and different ids can run in parallel.
+
+        ```python
+        executor = libmav.CallbackExecutor(4)
+        callback_handle = connection.add_message_callback(process, executor, 'message_id')
+        ```
+
+        A callback can be removed using `remove_message_callback()`
+
+        Args:
+            callbackFn (function): A callback function that takes a `Message` argument.
+            executor (libmav.CallbackExecutor): The executor the callback runs on.
+            ordering (str): `'connection'` or `'message_id'`.
+        """
+
+
+    def add_message_callback(self, callbackFn, max_rate_hz, keep='latest'):
+        """Add a callback function that is called at most `max_rate_hz` times per second for each message id.
+
+        Messages are decimated in C++, so high-rate streams (such as `HIGHRES_IMU` at 250 Hz) do not cross into python
+        only to be thrown away. With `keep='first'`, the first message of each window is delivered and the rest are dropped.
+        With `keep='latest'`, the first message is delivered immediately and the newest one of the window is delivered when
+        the window ends, so the callback always ends up with the most recent value.
+
+        ```python
+        callback_handle = connection.add_message_callback(update_ui, max_rate_hz=10)
+        ```
+
+        A callback can be removed using `remove_message_callback()`
+
+        Args:
+            callbackFn (function): A callback function that takes a `Message` argument.
+            max_rate_hz (float): Maximum number of messages per second and message id.
+            keep (string): `'latest'` or `'first'`.
+        """
                         
     def alive(self):
         """Test if connection is still alive.
@@ -93,7 +156,35 @@ class Connection():
         """
   
   
-    def expect(self, messageName):
+    def command(self, message, retries=3, timeout_ms=1000):
+        """Sends a command and returns its `COMMAND_ACK`, following the MAVLink command protocol.
+
+        The whole exchange runs in C++ with the GIL released: the command is resent up to `retries` times if no ack
+        arrives within `timeout_ms`, with the `confirmation` field of a `COMMAND_LONG` incremented on every resend.
+        An ack with `MAV_RESULT_IN_PROGRESS` means the vehicle is executing the command, so it is never resent after one:
+        every progress ack restarts the wait, and if `timeout_ms` then passes without an ack the command fails.
+        Acks are matched by `command`, and by the sender if `target_system` and `target_component` are set.
+
+        ```python
+        command = message_set.create('COMMAND_LONG').set_from_dict({
+            'target_system': 1, 'target_component': 1,
+            'command': message_set.enum('MAV_CMD_COMPONENT_ARM_DISARM'), 'param1': 1})
+        ack = connection.command(command)
+        ```
+
+        Args:
+            message (libmav.Message): A `COMMAND_LONG` or `COMMAND_INT` message.
+            retries (int): Number of resends after the first transmission.
+            timeout_ms (int): Time to wait for an ack after each transmission and after each `MAV_RESULT_IN_PROGRESS`.
+
+        Returns:
+            libmav.Message: The final `COMMAND_ACK`.
+
+        Raises:
+            TimeoutException: No final ack was received.
+        """
+
+    def expect(self, messageName, source_id=-1, component_id=-1, where=None):
         """Create an "expectation" that a particular message will be recieved.
 
         This is used when a message will only be emitted in response to another message.
@@ -111,14 +202,80 @@ class Connection():
         Note that if you use the `receive()` message that takes a `messageName`, there is a race condition.
         Using an expectation makes libmav start looking for the response immediately.
 
+        The expectation can be narrowed down to messages with particular field values using `where`.
+        The fields are compared on the receive thread, so messages that do not match never reach python.
+        Float fields are compared at the precision of the field, so `0.1` matches a `float` field set to `0.1`.
+
+        ```python
+        # Only the ACK of MAV_CMD_COMPONENT_ARM_DISARM, sent to us
+        expectation = connection.expect("COMMAND_ACK", where={"command": 400, "target_system": 255})
+        ```
+
         Args: 
             messageName (string): The name of the message to "expect".
+            source_id (int): Only match messages from this system id. By default any system matches.
+            component_id (int): Only match messages from this component id. By default any component matches.
+            where (dict): Field names and the values they must be equal to, `None` for none. Values can be `int`,
+                `float` or `str`; array fields other than strings cannot be compared.
 
         Returns:
             ExpectationWrapper: An "expectation" object for the specified message
                 (the type is largely irrelevant as it is intended for use in `receive()` only).
+
+        Raises:
+            KeyError: A field in `where` is not part of the message.
+            TypeError: A value in `where` does not fit the type of its field, or the field is an array.
         """  
+
+    def expect_async(self, messageName, source_id=-1, component_id=-1, where=None):
+        """Create an `asyncio` future that resolves with the next matching message.
+
+        This is the asyncio counterpart of `expect()`. The message is matched on the receive thread and
+        handed to the running event loop directly, without blocking an executor thread.
+        Like `expect()`, the future starts watching immediately, so create it before sending the triggering message.
+        Must be called from within a running event loop.
+
+        ```python
+        ack_future = connection.expect_async("COMMAND_ACK")
+        connection.send( <a command packaged in a message> )
+        command_ack = await asyncio.wait_for(ack_future, 3)
+        ```
+
+        Args:
+            messageName (string): The name (or id) of the message to wait for.
+            source_id (int): Only match messages from this system id. By default any system matches.
+            component_id (int): Only match messages from this component id. By default any component matches.
+            where (dict): Field names and the values they must be equal to, as in `expect()`.
+
+        Returns:
+            asyncio.Future: A future that resolves with the `Message`.
+        """
         
+    def latest(self, messageName, source_id=-1, component_id=-1):
+        """Returns the most recently received message with the given name (or id), or `None`.
+
+        Every received message is kept in a slot per message id, system id and component id, which
+        is overwritten by the receive thread. This lets applications poll state such as `ATTITUDE`
+        without running a callback or queue and discarding stale messages.
+        Messages are cached from the moment the connection is returned by `NetworkRuntime`.
+        Looking up a slot takes no lock; only copying the message out of it does. The cache holds up to 256 message ids
+        with up to 64 senders each, messages beyond that are not cached.
+
+        ```python
+        attitude = connection.latest("ATTITUDE", 1, 1)
+        if attitude is not None:
+            print(attitude["roll"])
+        ```
+
+        Args:
+            messageName (string): The name (or id) of the message.
+            source_id (int): System id of the sender. By default the newest message of any system is returned.
+            component_id (int): Component id of the sender. By default the newest message of any component is returned.
+
+        Returns:
+            Message: The newest matching message, or `None` if none was received yet.
+        """
+
     def partner(self):
         """Returns information about the connection partner of this Connection.
 
@@ -203,6 +360,30 @@ class Connection():
             Message: The message that was waited on.
         """   
 
+    def receive_any(self, expectations, timeout):
+        """Synchronously receive whichever of several _expected_ messages arrives first.
+
+        Blocks once until any of the expectations is met, instead of one `receive()` per expectation.
+        This is useful for command flows that wait for one of several possible responses.
+
+        ```python
+        ack = connection.expect("COMMAND_ACK")
+        text = connection.expect("STATUSTEXT")
+        connection.send( <a command packaged in a message> )
+        index, message = connection.receive_any([ack, text], 3000)
+        ```
+
+        If several expectations are already met, the one with the lowest index is returned.
+        The other expectations stay valid and can still be passed to `receive()` or `receive_any()`.
+
+        Args:
+            expectations (list): A list of expectations, created using `Connection.expect()`.
+            timeout (int): Timeout in milliseconds. By default there is no timeout.
+
+        Returns:
+            tuple: The index of the met expectation in `expectations` and the received `Message`.
+        """
+
     def remove_message_callback(self, callback_handle):
         """Removes a message callback that was previously added using `add_message_callback()`.
         
@@ -236,6 +417,94 @@ class Connection():
         """
         pass 
 
+    def send_many(self, messages):
+        """Send several messages in one call.
+
+        The messages are sent in order, and the GIL is released once for the whole list instead of once per message.
+        This removes the per-call overhead of `send()` for bulk transfers such as parameter or mission uploads.
+        Each message is still written on its own: the sequence numbers and the lock that keeps the writes of the
+        runtime apart are internal to `NetworkRuntime`, so the frames cannot be coalesced into a single write here.
+
+        ```python
+        connection.send_many([param_set_1, param_set_2, param_set_3])
+        ```
+
+        Args:
+            messages (list): The `Message` objects to send.
+
+        Raises:
+            TypeError: The list contains `None`.
+        """
+
+    def latency(self):
+        """Returns latency histograms of the receive path of the connection.
+
+        Messages are timestamped with a monotonic clock when the receive thread hands them over.
+        Use this to tell whether jitter in a control loop comes from the link or from waiting for the GIL.
+
+        ```python
+        latency = connection.latency()
+        print(latency['dispatch']['p99_ns'], latency['queue']['max_ns'])
+        ```
+
+        Returns:
+            dict: With the keys
+                - `queue`: Time messages wait in a `MessageQueue` until python takes them out.
+                - `dispatch`: Time the receive thread waits for the GIL before a python callback runs.
+
+                Each histogram holds `count`, `mean_ns`, `max_ns`, the percentiles `p50_ns`, `p90_ns`, `p99_ns` and `p999_ns`,
+                and `buckets`, a list of `(lower_bound_ns, count)` of all non-empty buckets.
+                Buckets are log-scaled, so percentiles are accurate to within 12.5%.
+        """
+
+    def stats(self):
+        """Returns a snapshot of the traffic statistics of the connection.
+
+        The counters are maintained in C++ with relaxed atomics, so they are cheap enough to be always on.
+        They help to tell whether a slow system is limited by the link bandwidth or by python.
+
+        ```python
+        stats = connection.stats()
+        print(stats['rx']['messages'], stats['rx']['by_id'][0]['bytes'])
+        ```
+
+        Returns:
+            dict: With the keys
+                - `rx` and `tx`: `messages` and `bytes` in total, and the same per message id in `by_id`.
+                  Bytes are counted as MAVLink frame sizes. Sent messages are counted for `send()`, `send_many()` and `SendQueue`.
+                - `callbacks`: `calls`, `total_ns` and `max_ns` of time spent in python message callbacks, once they hold the GIL.
+                  The wait for the GIL is reported by `latency()`.
+                - `queue_high_water`: The highest number of messages waiting in any `MessageQueue` of the connection.
+                - `senders`: Link quality per `(system_id, component_id)`, estimated from the MAVLink sequence numbers:
+                  `received`, `lost`, `duplicates`, `reordered` (late frames, no longer counted as lost), `resets`
+                  (the sender started its sequence over, e.g. after a reboot) and `loss_rate`.
+                  A frame is only credited back against `lost` if it arrives within 64 frames of the newest one.
+        """
+
+class CallbackExecutor():
+    """A pool of worker threads that runs message callbacks off the receive thread.
+
+    Pass it to `Connection.add_message_callback()`. One executor can be shared by any number of callbacks and connections.
+    Messages with the same ordering key always run on the same worker, so they stay in order.
+    More than one thread only helps if the callbacks release the GIL, for example while doing I/O.
+
+    ```python
+    executor = libmav.CallbackExecutor(threads=2)
+    ```
+
+    `len(executor)` returns the number of callbacks waiting to run.
+    Pending callbacks still run when the executor is destroyed.
+    With `'connection'` ordering, connections are spread over the workers in the order they were connected.
+
+    Args:
+        threads (int): Number of worker threads.
+        max_pending (int): Maximum number of callbacks queued per worker. Messages for a full worker are dropped.
+
+    Attributes:
+        threads (int): Number of worker threads.
+        dropped (int): Number of callbacks dropped because their worker was full.
+    """
+
 class ConnectionPartner():
     """A class representing the remote partner of a `Connection`.
     
@@ -343,6 +612,9 @@ class Message():
         header (libmav.Header): Message header information, such as compatibility flag information.
         id (int): Message ID. 
         name (string): Message name.
+        receive_time_ns (int): Monotonic time in nanoseconds (same clock as `time.monotonic_ns()`) at which the receive thread
+            handed the message to the bindings, before any wait for the GIL.
+            Set on messages from `MessageQueue` and message callbacks, `None` otherwise.
     """
 
 
@@ -441,6 +713,58 @@ class MessageDefinition():
         pass
 
 
+class MessageQueue():
+    """A queue collecting all messages received on a `Connection`, to be consumed at the pace of the application.
+
+    ```python
+    queue = libmav.MessageQueue(connection)
+    for message in queue:
+        print(message.name)
+    ```
+
+    The queue can also be consumed from `asyncio`: `fileno()` returns a file descriptor that is readable while
+    the queue holds messages, and `receive_async()` waits for the next message on the running event loop.
+
+    ```python
+    queue = libmav.MessageQueue(connection)
+    message = await queue.receive_async()
+    ```
+    """
+
+    def __init__(self, connection, rate=0, keep='latest'):
+        """Create a queue and start collecting messages received on `connection`.
+
+        With a `rate`, at most `rate` messages per second and message id are queued, decimated like
+        `Connection.add_message_callback()` with `max_rate_hz`.
+
+        Args:
+            connection (Connection): The connection to collect messages from.
+            rate (float): Maximum number of messages per second and message id. By default all messages are queued.
+            keep (string): `'latest'` or `'first'`, see `Connection.add_message_callback()`.
+        """
+
+    def next(self):
+        """Returns the oldest message in the queue, or `None` if the queue is empty."""
+
+    def fileno(self):
+        """Returns a file descriptor that is readable while the queue is not empty.
+
+        The descriptor is owned by the queue. It can be registered with `select` or `loop.add_reader()`,
+        but must not be read or closed by the application.
+
+        Returns:
+            int: The file descriptor.
+        """
+
+    def receive_async(self):
+        """Wait for the next message on the running `asyncio` event loop.
+
+        Only one `receive_async()` should be pending per queue at any time.
+
+        Returns:
+            asyncio.Future: A future that resolves with the next `Message`.
+        """
+
 class MessageSet():
     """A class representing a set of MAVLink message and enum definitions.
     
@@ -714,6 +1038,26 @@ class NetworkRuntime():
     ```
     <!-- line above needs to be checked -->
 
+    Each runtime runs its own receive thread, plus a heartbeat thread when it streams a HEARTBEAT.
+    To talk to many vehicles, prefer a single `UDPServer` runtime: it creates one `Connection` per partner on one receive thread.
+    Where one UDP link per vehicle is needed, create the runtimes without a HEARTBEAT message and stream the heartbeats of all
+    links from one `EmissionScheduler`, and run message callbacks on a shared `CallbackExecutor`.
+    This saves the heartbeat threads only: every runtime still has its own receive thread. The scheduler is one timer
+    thread that writes with ordinary blocking sends. There is no readiness multiplexing such as `epoll`.
+
+    The scheduler counts the sequence numbers of its identities itself, so the heartbeats must come from an identity that
+    the runtimes do not send with, such as another component id:
+
+    ```python
+    own_id = libmav.Identifier(253, 1)
+    heartbeat_id = libmav.Identifier(253, 2)
+    scheduler = libmav.EmissionScheduler(interfaces[0])
+    runtimes = []
+    for interface in interfaces:
+        runtimes.append(libmav.NetworkRuntime(own_id, common_messages, interface))
+        scheduler.add(heartbeat_message, 1, heartbeat_id, interface=interface)
+    ```
+
     """
 
     def __init__(self, own_mavlink_id, message_set, interface):
@@ -960,6 +1304,54 @@ class TCPServer():
         pass
     
 
+class TimeSync():
+    """Estimates the clock offset to the systems on a connection with the MAVLink `TIMESYNC` protocol.
+
+    Everything runs in C++: `TIMESYNC` requests from other systems are answered right on the receive thread,
+    and requests of our own are sent every `interval_ms` from a timer thread, so the GIL never adds to the round trip.
+    Offset and round trip time are filtered per system; samples whose round trip is far above the filtered one are rejected.
+    If several samples in a row are rejected, the link itself got slower, and the filter converges again from scratch.
+    Answers are addressed to the requesting system and component (`target_system`, `target_component`) when the
+    message set has these fields. They are sent, and counted in `Connection.stats()`, on the receive thread.
+
+    Host time is the monotonic clock, the same as `time.monotonic_ns()` and `Message.receive_time_ns`.
+
+    ```python
+    time_sync = libmav.TimeSync(connection, message_set)
+    # once estimates are available
+    host_ns = time_sync.to_host_ns(1, msg['time_usec'] * 1000)
+    ```
+
+    Args:
+        connection (libmav.Connection): The connection to the systems.
+        message_set (libmav.MessageSet): A message set with `TIMESYNC`.
+        interval_ms (int): Interval between our requests, 0 to only answer requests of others.
+        respond (bool): Whether to answer `TIMESYNC` requests of other systems.
+    """
+
+    def estimates(self):
+        """Returns the current estimates.
+
+        Returns:
+            dict: Maps system ids to a dict with `offset_ns` (remote minus host time), `rtt_ns`, `samples` and `rejected`.
+        """
+
+    def offset_ns(self, system_id):
+        """Returns the offset of a system's clock to the host clock in nanoseconds, `None` before the first sample."""
+
+    def to_host_ns(self, system_id, remote_ns):
+        """Converts a timestamp of a system, in nanoseconds, to host monotonic time in nanoseconds.
+
+        Raises:
+            ValueError: There is no estimate for the system yet.
+        """
+
+class TimeoutException(RuntimeError):
+    """Raised when the other side stops responding, for example by `Connection.command()` and the protocol clients.
+
+    It is a subclass of `RuntimeError`.
+    """
+
 class UDPClient():
     """Represents a UDP socket connection to a port on a remote computer.
     
@@ -1020,6 +1412,432 @@ class UDPServer():
         pass
 
 
+class SendQueue():
+    """A bounded queue of outgoing messages, written to a `Connection` by a dedicated writer thread.
+
+    `Connection.send()` writes on the caller's thread, so a slow serial link or a full TCP socket buffer blocks the caller.
+    With a `SendQueue`, the caller only enqueues a copy of the message. When the link cannot keep up, the queue fills up
+    and `send()` blocks (up to its timeout) or `send_nowait()` returns `False`, which makes congestion visible as backpressure.
+
+    ```python
+    send_queue = libmav.SendQueue(connection, max_depth=64)
+    if not send_queue.send_nowait(setpoint_message):
+        print('link congested', send_queue.stats())
+    ```
+
+    Messages still in the queue when it is destroyed are discarded; only a write already in progress is finished.
+    Call `flush()` first to deliver them.
+
+    Outgoing messages are sorted into three priority lanes, `SendQueue.PRIORITY_HIGH`, `SendQueue.PRIORITY_NORMAL` and
+    `SendQueue.PRIORITY_BULK`. The writer always sends from the highest non-empty lane, so commands are not delayed by
+    bulk traffic such as parameter sync or log download queued ahead of them. Each lane holds up to `max_depth` messages.
+    On low-bandwidth serial or radio links, `max_bytes_per_second` paces the writer so that the radio buffer is not overrun,
+    which keeps the queueing, and with it the prioritization, on the host.
+
+    ```python
+    send_queue = libmav.SendQueue(connection, max_bytes_per_second=5000)
+    for param_set in param_sets:
+        send_queue.send(param_set, priority=libmav.SendQueue.PRIORITY_BULK)
+    send_queue.send(arm_command)  # COMMAND_LONG is sent ahead of the queued parameters
+    ```
+    """
+
+    def __init__(self, connection, max_depth=256, priorities={75: 0, 76: 0}, max_bytes_per_second=0):
+        """Create a send queue and start its writer thread.
+
+        Args:
+            connection (Connection): The connection to send on.
+            max_depth (int): Maximum number of queued messages per priority lane.
+            priorities (dict): Priority lane for message ids. Ids that are not listed go to `PRIORITY_NORMAL`.
+                By default `COMMAND_INT` and `COMMAND_LONG` go to `PRIORITY_HIGH`.
+            max_bytes_per_second (float): Maximum rate at which the writer sends. By default the writer is not paced.
+        """
+
+    def send(self, message, timeout_ms=-1, priority=-1):
+        """Queue a message, waiting for room in its lane if the lane is full.
+
+        Raises an exception if the lane is still full after `timeout_ms`.
+
+        Args:
+            message (Message): The message to send. It is copied, so it can be modified afterwards.
+            timeout_ms (int): Maximum time to wait for room, in milliseconds. By default there is no timeout.
+            priority (int): The priority lane. By default the lane is chosen from the `priorities` of the queue.
+        """
+
+    def send_nowait(self, message, priority=-1):
+        """Queue a message if there is room in its lane.
+
+        Args:
+            message (Message): The message to send. It is copied, so it can be modified afterwards.
+            priority (int): The priority lane. By default the lane is chosen from the `priorities` of the queue.
+
+        Returns:
+            boolean: `True` if the message was queued, `False` if the queue is full.
+        """
+
+    def flush(self, timeout_ms=-1):
+        """Wait until all queued messages have been written.
+
+        Args:
+            timeout_ms (int): Maximum time to wait, in milliseconds. By default there is no timeout.
+
+        Returns:
+            boolean: `True` if the queue was drained, `False` on timeout.
+        """
+
+    def stats(self):
+        """Returns queue metrics.
+
+        Returns:
+            dict: `depth` (currently queued), `max_depth`, `high_water` (highest lane depth so far),
+                `sent`, `rejected` (full on `send_nowait()` or `send()` timeout) and `errors` (failed writes).
+                `lanes` holds `depth`, `high_water`, `sent` and `rejected` for each priority lane.
+        """
+
+class EmissionScheduler():
+    """Sends messages periodically from arbitrary identities over one interface.
+
+    All emissions are driven by one thread with a hashed timer wheel, so a process can emulate hundreds of components
+    without a `NetworkRuntime` each. Every identity gets its own sequence numbers.
+    Emissions can also go out on other interfaces, so one scheduler can stream the HEARTBEATs of many links.
+    Messages are written to the interface directly; they do not go through a `Connection` and are not counted in its stats.
+    That is why interfaces must be UDP interfaces (`UDPServer` or `UDPClient`): on TCP and serial links the frames could
+    interleave with those the `NetworkRuntime` of the link writes.
+
+    The sequence numbers of an identity are counted by the scheduler alone. Scheduled identities must therefore differ
+    from the identities of runtimes and connections on the same links, or both count the same sequence and the
+    receivers report losses and duplicates.
+
+    ```python
+    scheduler = libmav.EmissionScheduler(interface)
+    for system_id in range(1, 201):
+        scheduler.add(heartbeat, 1, libmav.Identifier(system_id, 1))
+    ```
+
+    Args:
+        interface (libmav.NetworkInterface): The UDP interface to send on.
+        tick_us (int): Resolution of the timer in microseconds. Rates are rounded to whole ticks.
+
+    Raises:
+        ValueError: The interface is not a UDP interface.
+    """
+
+    def add(self, message, rate_hz, sender, partner=None, interface=None):
+        """Starts sending a copy of a message periodically.
+
+        Args:
+            message (libmav.Message): The message to send.
+            rate_hz (float): How often to send it.
+            sender (libmav.Identifier): The system and component id to send it from.
+            partner (libmav.ConnectionPartner): Whom to send it to on a server interface, from `Connection.partner()`.
+                Client interfaces send to their server.
+            interface (libmav.NetworkInterface): The UDP interface to send it on. Defaults to the scheduler's interface.
+
+        Returns:
+            int: A handle for `remove()`.
+
+        Raises:
+            ValueError: The interface is not a UDP interface.
+        """
+
+    def remove(self, handle):
+        """Stops sending a message added with `add()`."""
+
+    def stats(self):
+        """Returns the number of messages `sent` and of failed writes (`errors`)."""
+
+class FtpClient():
+    """Reads files from a vehicle with the MAVLink FTP protocol (`FILE_TRANSFER_PROTOCOL`).
+
+    Files are streamed with burst reads in C++ with the GIL released.
+    Chunks lost on the way are tracked by offset and read again one by one.
+
+    ```python
+    client = libmav.FtpClient(connection, message_set, target_system=1, target_component=1)
+    params = client.read('@PARAM/param.pck')
+    with open('log.ulg', 'wb') as f:
+        client.read_to_fd('/fs/microsd/log/2024-01-01/12_00_00.ulg', f.fileno())
+    ```
+
+    Args:
+        connection (libmav.Connection): The connection to the vehicle.
+        message_set (libmav.MessageSet): A message set with `FILE_TRANSFER_PROTOCOL`.
+        target_system (int): System id of the vehicle, 0 for any.
+        target_component (int): Component id of the vehicle, 0 for any.
+    """
+
+    def read(self, path, timeout_ms=1000, retries=5):
+        """Reads a file.
+
+        Args:
+            path (str): Path of the file on the vehicle.
+            timeout_ms (int): Time to wait for each reply.
+            retries (int): Number of resends of a request, or of bursts without progress, before the read fails.
+
+        Returns:
+            bytes: The contents of the file.
+
+        Raises:
+            TimeoutException: The vehicle stopped responding.
+            RuntimeError: The vehicle returned an error, for example because the file does not exist.
+        """
+
+    def read_into(self, path, buffer, timeout_ms=1000, retries=5):
+        """Reads a file into a writable buffer, such as a `bytearray` or `memoryview`, without an intermediate copy.
+
+        Returns:
+            int: The size of the file.
+        """
+
+    def read_to_fd(self, path, fd, timeout_ms=1000, retries=5):
+        """Reads a file and writes each chunk to a file descriptor at its offset, with `pwrite()`.
+
+        Chunks arrive out of order, so the descriptor must be seekable, such as a file.
+
+        Returns:
+            int: The size of the file.
+
+        Raises:
+            ValueError: The descriptor is not seekable, such as a pipe, socket or terminal.
+        """
+
+class LogDownloader():
+    """Downloads onboard logs with `LOG_REQUEST_DATA`.
+
+    The download runs in C++ with the GIL released. Each `LOG_DATA` chunk is written to the output file at its offset
+    as it arrives, and holes are requested again as ranges once the stream goes quiet.
+
+    ```python
+    downloader = libmav.LogDownloader(connection, message_set, target_system=1, target_component=1)
+    for entry in downloader.entries():
+        downloader.download(entry['id'], 'log_{}.ulg'.format(entry['id']))
+    ```
+
+    Args:
+        connection (libmav.Connection): The connection to the vehicle.
+        message_set (libmav.MessageSet): A message set with the log messages.
+        target_system (int): System id of the vehicle, 0 for any.
+        target_component (int): Component id of the vehicle, 0 for any.
+    """
+
+    def entries(self, first=0, last=0xFFFF, timeout_ms=1000, retries=3):
+        """Lists the logs on the vehicle.
+
+        Returns:
+            list: One dict per log with `id`, `time_utc` and `size`.
+        """
+
+    def download(self, log_id, path, timeout_ms=1000, retries=5):
+        """Downloads a log into a file, which is created or overwritten.
+
+        Args:
+            log_id (int): Id of the log, from `entries()`.
+            path (str): Path of the output file.
+            timeout_ms (int): How long the stream may be quiet before missing data is requested again.
+            retries (int): Number of requests in a row without progress before the download fails.
+
+        Returns:
+            int: The size of the log.
+
+        Raises:
+            TimeoutException: The vehicle stopped responding.
+        """
+
+    def download_to_fd(self, log_id, fd, timeout_ms=1000, retries=5):
+        """Downloads a log, writing each chunk to a file descriptor at its offset with `pwrite()`.
+
+        Chunks arrive out of order, so the descriptor must be seekable, such as a file. A regular file is resized to
+        the size of the log first.
+
+        Returns:
+            int: The size of the log.
+
+        Raises:
+            ValueError: The descriptor is not seekable, such as a pipe, socket or terminal.
+        """
+
+class MissionClient():
+    """Uploads and downloads missions with the MAVLink mission protocol.
+
+    The transfer runs in C++ with the GIL released, including timeouts and retransmits.
+    Mission items are passed as columns: a dict that maps `MISSION_ITEM_INT` field names to lists with one value per item.
+    `seq`, `mission_type` and the target fields are set by the client.
+
+    ```python
+    client = libmav.MissionClient(connection, message_set, target_system=1, target_component=1)
+    client.upload({
+        'command': [16, 16],
+        'frame': [6, 6],
+        'x': [473977420, 473978000],
+        'y': [85455940, 85456000],
+        'z': [10.0, 10.0]
+    }, progress=lambda done, total: print(done, total))
+    mission = client.download()
+    ```
+
+    Args:
+        connection (libmav.Connection): The connection to the vehicle.
+        message_set (libmav.MessageSet): A message set with the mission messages.
+        target_system (int): System id of the vehicle, 0 for any.
+        target_component (int): Component id of the vehicle, 0 for any.
+    """
+
+    def upload(self, items, mission_type=0, progress=None, timeout_ms=1000, retries=5):
+        """Uploads a mission.
+
+        Args:
+            items (dict): Columns of the mission items. All lists must have the same length. Missing fields are 0.
+            mission_type (int): The `MAV_MISSION_TYPE`.
+            progress (function): Called with the number of transferred items and the total, whenever the percentage changes.
+            timeout_ms (int): Time to wait for the vehicle before the last message is resent.
+            retries (int): Number of resends in a row before the upload fails.
+
+        Raises:
+            TimeoutException: The vehicle stopped responding.
+            RuntimeError: The vehicle rejected the mission.
+            ValueError: A column is not a `MISSION_ITEM_INT` field, is set by the client, or the columns differ in length. Nothing is sent.
+        """
+
+    def download(self, mission_type=0, progress=None, timeout_ms=1000, retries=5):
+        """Downloads a mission.
+
+        Args:
+            mission_type (int): The `MAV_MISSION_TYPE`.
+            progress (function): Called with the number of transferred items and the total, whenever the percentage changes.
+            timeout_ms (int): Time to wait for each reply before the request is resent.
+            retries (int): Number of resends of a request before the download fails.
+
+        Returns:
+            dict: The columns of the mission items, one list per `MISSION_ITEM_INT` field.
+
+        Raises:
+            TimeoutException: The vehicle stopped responding.
+        """
+
+class ParamClient():
+    """Downloads the parameters of a component with the MAVLink parameter protocol.
+
+    The download runs in C++ with the GIL released: `PARAM_VALUE` messages are collected on the receive thread,
+    and once the stream goes quiet, missing parameters are requested by index with `PARAM_REQUEST_READ`.
+    At most `max_in_flight` requests are outstanding at a time; the next one is sent as soon as an answer arrives.
+
+    ```python
+    params = libmav.ParamClient(connection, message_set, target_system=1, target_component=1).fetch_all()
+    print(params['SYS_AUTOSTART'])
+    ```
+
+    Args:
+        connection (libmav.Connection): The connection to the vehicle.
+        message_set (libmav.MessageSet): A message set with the parameter messages.
+        target_system (int): System id of the component, 0 for any.
+        target_component (int): Component id of the component, 0 for any.
+    """
+
+    def fetch_all(self, timeout_ms=1000, retries=3, bytewise=True, max_in_flight=8):
+        """Downloads all parameters.
+
+        Args:
+            timeout_ms (int): How long the stream may be quiet before missing parameters are requested again.
+            retries (int): Number of rounds of requests for missing parameters.
+            bytewise (bool): Whether integer parameters are packed into the bytes of `param_value` (as PX4 does),
+                or converted to float (as ArduPilot does).
+            max_in_flight (int): Number of `PARAM_REQUEST_READ` sent before waiting for an answer.
+
+        Returns:
+            dict: Parameter values by name, as `int` for integer types and `float` otherwise.
+
+        Raises:
+            ValueError: `max_in_flight` is 0.
+            TimeoutException: Not all parameters were received.
+        """
+
+class RedundantLinkGroup():
+    """Merges connections that carry the same traffic over redundant links, such as LTE and a radio.
+
+    Every message is delivered once, the first time it arrives on any of the links.
+    Later copies are recognized in C++ by `(system_id, component_id, seq, message id)` within a sliding window of
+    the last `window` messages per sender, so they never reach python.
+
+    ```python
+    group = libmav.RedundantLinkGroup([lte_connection, radio_connection])
+    group.add_message_callback(lambda msg: print(msg.name))
+    ```
+
+    Args:
+        connections (list): The `Connection` objects of the links.
+        window (int): Number of recent messages per sender that duplicates are checked against.
+    """
+
+    def add_message_callback(self, callbackFn):
+        """Adds a callback that is called with every message, once.
+
+        Returns:
+            int: A handle for `remove_message_callback()`.
+        """
+
+    def remove_message_callback(self, handle):
+        """Removes a callback added with `add_message_callback()`."""
+
+    def stats(self):
+        """Returns counters per link, in the order of `connections`.
+
+        Returns:
+            list: One dict per link with `received`, `first` (messages that arrived on this link first), `duplicates`
+                and `mean_delay_ns`, how much later than the first copy the duplicates on this link arrived.
+        """
+
+    fastest = None
+    """int: Index of the link that delivered the most messages first, `None` before any message arrived."""
+
+class Router():
+    """Forwards MAVLink traffic between connections in C++, without a GIL round trip per message.
+
+    Each link is a connection together with the physical interface it belongs to.
+    The router learns on which link every `(system_id, component_id)` was seen.
+    Messages without a `target_system` (or with target 0) are broadcast to all other links,
+    targeted messages only go to the links their target was seen on.
+    Frames are forwarded as received, with their original sender and sequence number.
+    Messages still reach the python callbacks and queues of the connections.
+
+    ```python
+    router = libmav.Router()
+    router.add_link(serial, autopilot_connection)
+    router.add_link(udp_server, gcs_connection)
+    ```
+
+    Only messages of the `MessageSet` of the runtimes are forwarded, as others are dropped by the parser.
+    Frames are written through the same send lock as the frames of the link's `NetworkRuntime`, so any interface works,
+    including TCP and serial links.
+    """
+
+    def add_link(self, interface, connection):
+        """Adds a connection to the router.
+
+        Args:
+            interface (libmav.NetworkInterface): The physical interface the connection belongs to, such as a `UDPServer`.
+            connection (libmav.Connection): The connection.
+
+        Returns:
+            int: The index of the link.
+
+        Raises:
+            ValueError: The connection does not come from a `NetworkRuntime` on `interface`.
+        """
+
+    def routes(self):
+        """Returns the learned routes.
+
+        Returns:
+            dict: Maps `(system_id, component_id)` to the list of link indices it was seen on.
+        """
+
+    def stats(self):
+        """Returns counters per link.
+
+        Returns:
+            list: One dict per link with `received`, `sent` and `unroutable` (targeted messages for which no route was known).
+        """
+
 class Serial():
     """Represents a connection for listening on a specified serial port for MAVLink traffic.
     <!-- does it listen or ping, or both? How do we describe this-->
@@ -0,0 +1,85 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_BYTERANGES_H
+#define LIBMAV_PYTHON_BYTERANGES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <utility>
+
+namespace libmav_python {
+
+    // Byte ranges of a file that have been received, merged as they come in
+    class ByteRanges {
+    private:
+        // start -> end
+        std::map<uint32_t, uint32_t> _ranges;
+
+    public:
+        void mark(uint32_t start, uint32_t end) {
+            auto it = _ranges.upper_bound(start);
+            if (it != _ranges.begin() && std::prev(it)->second >= start) {
+                --it;
+                start = it->first;
+            }
+            while (it != _ranges.end() && it->first <= end) {
+                end = std::max(end, it->second);
+                it = _ranges.erase(it);
+            }
+            _ranges.emplace(start, end);
+        }
+
+        // end of the highest range received so far
+        uint32_t end() const {
+            return _ranges.empty() ? 0 : _ranges.rbegin()->second;
+        }
+
+        // first range below end() that is missing, empty if there is none
+        std::pair<uint32_t, uint32_t> firstGap() const {
+            uint32_t previous_end = 0;
+            for (const auto &[start, end] : _ranges) {
+                if (start > previous_end) {
+                    return {previous_end, start};
+                }
+                previous_end = end;
+            }
+            return {previous_end, previous_end};
+        }
+    };
+}
+
+#endif //LIBMAV_PYTHON_BYTERANGES_H
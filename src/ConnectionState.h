@@ -0,0 +1,595 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_CONNECTIONSTATE_H
+#define LIBMAV_PYTHON_CONNECTIONSTATE_H
+
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "LockedInterface.h"
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <map>
+#include <chrono>
+#include <array>
+#include <algorithm>
+#include <thread>
+
+namespace libmav_python {
+
+    using mav::Connection;
+    using mav::Message;
+    using mav::ANY_ID;
+
+    // Fixed-capacity hash table that only ever grows, so that the receive path can look up and add
+    // entries without locks. Values are created on first use and live as long as the table.
+    template <typename Value, std::size_t CAPACITY>
+    class InsertOnlyTable {
+    private:
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+        static constexpr uint64_t EMPTY = ~uint64_t{0};
+
+        struct Cell {
+            std::atomic<uint64_t> key{EMPTY};
+            // null while the inserting thread is still constructing the value
+            std::atomic<Value*> value{nullptr};
+        };
+
+        std::unique_ptr<Cell[]> _cells = std::make_unique<Cell[]>(CAPACITY);
+
+        static std::size_t _home(uint64_t key) {
+            return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (CAPACITY - 1);
+        }
+
+    public:
+        InsertOnlyTable() = default;
+        InsertOnlyTable(const InsertOnlyTable &) = delete;
+        InsertOnlyTable &operator=(const InsertOnlyTable &) = delete;
+
+        ~InsertOnlyTable() {
+            for (std::size_t i = 0; i < CAPACITY; i++) {
+                delete _cells[i].value.load(std::memory_order_relaxed);
+            }
+        }
+
+        Value *find(uint64_t key) const {
+            for (std::size_t i = 0, slot = _home(key); i < CAPACITY; i++, slot = (slot + 1) & (CAPACITY - 1)) {
+                const uint64_t cell_key = _cells[slot].key.load(std::memory_order_acquire);
+                if (cell_key == key) {
+                    return _cells[slot].value.load(std::memory_order_acquire);
+                }
+                if (cell_key == EMPTY) {
+                    return nullptr;
+                }
+            }
+            return nullptr;
+        }
+
+        // Returns the value of the key, constructing it from args if it is new. Null once the table is full.
+        template <typename... Args>
+        Value *insert(uint64_t key, Args &&...args) {
+            for (std::size_t i = 0, slot = _home(key); i < CAPACITY; i++, slot = (slot + 1) & (CAPACITY - 1)) {
+                Cell &cell = _cells[slot];
+                uint64_t cell_key = cell.key.load(std::memory_order_acquire);
+                if (cell_key == EMPTY &&
+                    cell.key.compare_exchange_strong(cell_key, key, std::memory_order_acq_rel)) {
+                    auto value = new Value(std::forward<Args>(args)...);
+                    cell.value.store(value, std::memory_order_release);
+                    return value;
+                }
+                if (cell_key == key) {
+                    Value *value;
+                    while (!(value = cell.value.load(std::memory_order_acquire))) {
+                        std::this_thread::yield();
+                    }
+                    return value;
+                }
+            }
+            return nullptr;
+        }
+
+        template <typename F>
+        void forEach(F &&f) const {
+            for (std::size_t i = 0; i < CAPACITY; i++) {
+                if (Value *value = _cells[i].value.load(std::memory_order_acquire)) {
+                    f(_cells[i].key.load(std::memory_order_relaxed), *value);
+                }
+            }
+        }
+    };
+
+    inline uint64_t senderKey(int system_id, int component_id) {
+        return static_cast<uint64_t>((system_id << 8) | component_id);
+    }
+
+    // Newest message per (message id, system id, component id), overwritten in place by the receive thread.
+    // Lookups take no lock but the one of the slot that is copied out. Keeps up to 256 message ids with
+    // up to 64 senders each, later ones are not cached.
+    class LatestMessageCache {
+    private:
+        struct Slot {
+            std::mutex lock;
+            // order of the last update, 0 until the slot holds a message
+            std::atomic<uint64_t> stamp{0};
+            std::optional<Message> message;
+        };
+
+        struct Senders {
+            const int message_id;
+            const std::string name;
+            InsertOnlyTable<Slot, 64> slots;
+
+            Senders(int message_id, std::string name) : message_id(message_id), name(std::move(name)) {}
+        };
+
+        struct Named {
+            const Senders &senders;
+
+            explicit Named(const Senders &senders) : senders(senders) {}
+        };
+
+        InsertOnlyTable<Senders, 256> _by_id;
+        // keyed by the hash of the message name
+        InsertOnlyTable<Named, 256> _by_name;
+        std::atomic<uint64_t> _stamp{0};
+
+        static uint64_t _nameKey(const std::string &name) {
+            // clears the top bit, so that no hash collides with the empty key
+            return std::hash<std::string>{}(name) >> 1;
+        }
+
+    public:
+        void update(const Message &message) {
+            const int message_id = message.id();
+            const uint64_t key = senderKey(message.header().systemId(), message.header().componentId());
+
+            Senders *senders = _by_id.find(message_id);
+            Slot *slot = senders ? senders->slots.find(key) : nullptr;
+            if (!slot) {
+                // first message from this sender
+                senders = _by_id.insert(message_id, message_id, message.name());
+                if (!senders) {
+                    return;
+                }
+                slot = senders->slots.insert(key);
+                if (!slot) {
+                    return;
+                }
+                _by_name.insert(_nameKey(senders->name), *senders);
+            }
+
+            std::lock_guard lg{slot->lock};
+            slot->message = message;
+            slot->stamp.store(++_stamp, std::memory_order_release);
+        }
+
+        std::optional<Message> latest(int message_id, int system_id = ANY_ID, int component_id = ANY_ID) const {
+            const Senders *senders = _by_id.find(message_id);
+            if (!senders) {
+                return std::nullopt;
+            }
+            Slot *newest = nullptr;
+            if (system_id != ANY_ID && component_id != ANY_ID) {
+                newest = senders->slots.find(senderKey(system_id, component_id));
+            } else {
+                uint64_t newest_stamp = 0;
+                senders->slots.forEach([&](uint64_t key, Slot &slot) {
+                    const uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+                    if ((system_id == ANY_ID || static_cast<int>(key >> 8) == system_id) &&
+                        (component_id == ANY_ID || static_cast<int>(key & 0xFF) == component_id) &&
+                        stamp > newest_stamp) {
+                        newest = &slot;
+                        newest_stamp = stamp;
+                    }
+                });
+            }
+            if (!newest || newest->stamp.load(std::memory_order_acquire) == 0) {
+                return std::nullopt;
+            }
+            std::lock_guard lg{newest->lock};
+            return newest->message;
+        }
+
+        std::optional<Message> latest(const std::string &message_name, int system_id = ANY_ID,
+                                      int component_id = ANY_ID) const {
+            const Named *named = _by_name.find(_nameKey(message_name));
+            if (!named || named->senders.name != message_name) {
+                return std::nullopt;
+            }
+            return latest(named->senders.message_id, system_id, component_id);
+        }
+    };
+
+    // Size of the MAVLink frame of a received or sent message
+    inline uint32_t frameSize(const Message &message) {
+        auto header = message.header();
+        uint32_t size = mav::MessageDefinition::HEADER_SIZE + header.len() + mav::MessageDefinition::CHECKSUM_SIZE;
+        if (header.incompatFlags() & 0x01) {
+            size += mav::MessageDefinition::SIGNATURE_SIZE;
+        }
+        return size;
+    }
+
+    // Traffic counters of a connection. Updated with relaxed atomics in preallocated slots, so the receive path
+    // takes no lock, but a snapshot is not guaranteed to be consistent across counters.
+    class TrafficStats {
+    public:
+        struct Counters {
+            std::atomic<uint64_t> messages{0};
+            std::atomic<uint64_t> bytes{0};
+
+            void add(uint64_t size) {
+                messages.fetch_add(1, std::memory_order_relaxed);
+                bytes.fetch_add(size, std::memory_order_relaxed);
+            }
+        };
+
+        struct CountersSnapshot {
+            uint64_t messages = 0;
+            uint64_t bytes = 0;
+        };
+
+        struct DirectionSnapshot {
+            CountersSnapshot total;
+            std::map<int, CountersSnapshot> by_id;
+        };
+
+        struct Snapshot {
+            DirectionSnapshot rx;
+            DirectionSnapshot tx;
+            uint64_t callback_calls = 0;
+            uint64_t callback_ns = 0;
+            uint64_t callback_max_ns = 0;
+            uint64_t queue_high_water = 0;
+        };
+
+    private:
+        class Direction {
+        private:
+            Counters _total;
+            // message ids beyond the capacity are only counted in the total
+            InsertOnlyTable<Counters, 512> _by_id;
+
+        public:
+            void add(int message_id, uint64_t size) {
+                _total.add(size);
+                Counters *counters = _by_id.find(message_id);
+                if (!counters) {
+                    counters = _by_id.insert(message_id);
+                }
+                if (counters) {
+                    counters->add(size);
+                }
+            }
+
+            DirectionSnapshot snapshot() const {
+                DirectionSnapshot snapshot;
+                snapshot.total = {_total.messages.load(std::memory_order_relaxed),
+                                  _total.bytes.load(std::memory_order_relaxed)};
+                _by_id.forEach([&snapshot](uint64_t id, const Counters &counters) {
+                    snapshot.by_id[static_cast<int>(id)] = {counters.messages.load(std::memory_order_relaxed),
+                                                            counters.bytes.load(std::memory_order_relaxed)};
+                });
+                return snapshot;
+            }
+        };
+
+        static void _storeMax(std::atomic<uint64_t> &target, uint64_t value) {
+            uint64_t current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+        }
+
+        Direction _rx;
+        Direction _tx;
+        std::atomic<uint64_t> _callback_calls{0};
+        std::atomic<uint64_t> _callback_ns{0};
+        std::atomic<uint64_t> _callback_max_ns{0};
+        std::atomic<uint64_t> _queue_high_water{0};
+
+    public:
+        void recordReceived(const Message &message) {
+            _rx.add(message.id(), frameSize(message));
+        }
+
+        void recordSent(const Message &message) {
+            _tx.add(message.id(), frameSize(message));
+        }
+
+        // time spent in a python callback, once it holds the GIL
+        void recordCallback(std::chrono::steady_clock::duration duration) {
+            auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+            _callback_calls.fetch_add(1, std::memory_order_relaxed);
+            _callback_ns.fetch_add(ns, std::memory_order_relaxed);
+            _storeMax(_callback_max_ns, ns);
+        }
+
+        void recordQueueDepth(std::size_t depth) {
+            _storeMax(_queue_high_water, depth);
+        }
+
+        Snapshot snapshot() {
+            Snapshot snapshot;
+            snapshot.rx = _rx.snapshot();
+            snapshot.tx = _tx.snapshot();
+            snapshot.callback_calls = _callback_calls.load(std::memory_order_relaxed);
+            snapshot.callback_ns = _callback_ns.load(std::memory_order_relaxed);
+            snapshot.callback_max_ns = _callback_max_ns.load(std::memory_order_relaxed);
+            snapshot.queue_high_water = _queue_high_water.load(std::memory_order_relaxed);
+            return snapshot;
+        }
+    };
+
+    // Packet loss per sender, estimated from the MAVLink sequence number of every received frame.
+    // Updated by the receive thread only, so the per-sender state needs no lock; counters are relaxed
+    // atomics so that snapshots can be taken from other threads. Tracks up to 256 senders.
+    class SequenceTracker {
+    public:
+        struct Sender {
+            uint64_t received = 0;
+            uint64_t lost = 0;
+            uint64_t duplicates = 0;
+            uint64_t reordered = 0;
+            // the sender restarted its sequence, e.g. after a reboot
+            uint64_t resets = 0;
+        };
+
+    private:
+        // how far back a late frame can still be credited against a counted loss
+        static constexpr int WINDOW = 64;
+
+        struct Slot {
+            std::atomic<uint64_t> received{0};
+            std::atomic<uint64_t> lost{0};
+            std::atomic<uint64_t> duplicates{0};
+            std::atomic<uint64_t> reordered{0};
+            std::atomic<uint64_t> resets{0};
+            // receive thread only
+            bool started = false;
+            uint8_t last_seq = 0;
+            // bit k set: last_seq - k was counted as lost
+            uint64_t missing = 0;
+            // a frame older than last_seq that was not missing, counted as duplicate for now
+            std::optional<uint8_t> suspect;
+        };
+
+        InsertOnlyTable<Slot, 256> _senders;
+
+        static void _bump(std::atomic<uint64_t> &counter, int64_t by = 1) {
+            counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        }
+
+        static void _restart(Slot &slot, uint8_t seq) {
+            _bump(slot.resets);
+            slot.last_seq = seq;
+            slot.missing = 0;
+            slot.suspect.reset();
+        }
+
+    public:
+        void update(const Message &message) {
+            auto header = message.header();
+            const uint8_t seq = header.seq();
+            const uint64_t key = senderKey(header.systemId(), header.componentId());
+            Slot *slot = _senders.find(key);
+            if (!slot && !(slot = _senders.insert(key))) {
+                return;
+            }
+            _bump(slot->received);
+            if (!slot->started) {
+                slot->started = true;
+                slot->last_seq = seq;
+                return;
+            }
+            const uint8_t ahead = seq - slot->last_seq;
+            if (ahead == 0) {
+                _bump(slot->duplicates);
+            } else if (ahead < 128) {
+                // skipped frames are counted as lost until they turn up late
+                _bump(slot->lost, ahead - 1);
+                slot->missing = ahead < WINDOW ? slot->missing << ahead : 0;
+                const int skipped = std::min<int>(ahead - 1, WINDOW - 1);
+                slot->missing |= ((uint64_t{1} << skipped) - 1) << 1;
+                slot->last_seq = seq;
+                slot->suspect.reset();
+            } else {
+                const int behind = static_cast<uint8_t>(slot->last_seq - seq);
+                if (behind < WINDOW && (slot->missing >> behind) & 1) {
+                    // late, and was counted as lost
+                    slot->missing &= ~(uint64_t{1} << behind);
+                    _bump(slot->reordered);
+                    _bump(slot->lost, -1);
+                } else if (behind >= WINDOW) {
+                    _restart(*slot, seq);
+                } else if (slot->suspect && static_cast<uint8_t>(*slot->suspect + 1) == seq) {
+                    // two old frames in a row: the sender started over, the first was no duplicate
+                    _bump(slot->duplicates, -1);
+                    _restart(*slot, seq);
+                } else {
+                    _bump(slot->duplicates);
+                    slot->suspect = seq;
+                }
+            }
+        }
+
+        // keyed by (system id << 8 | component id)
+        std::map<uint16_t, Sender> snapshot() const {
+            std::map<uint16_t, Sender> senders;
+            _senders.forEach([&senders](uint64_t key, const Slot &slot) {
+                senders[static_cast<uint16_t>(key)] = {slot.received.load(std::memory_order_relaxed),
+                                                       slot.lost.load(std::memory_order_relaxed),
+                                                       slot.duplicates.load(std::memory_order_relaxed),
+                                                       slot.reordered.load(std::memory_order_relaxed),
+                                                       slot.resets.load(std::memory_order_relaxed)};
+            });
+            return senders;
+        }
+    };
+
+    // Log-bucketed latency histogram in the style of HdrHistogram: every power of two is split into
+    // eight linear sub-buckets, so a recorded value is off by less than 12.5%. Lock free, so that
+    // the receive thread never blocks on a reader.
+    class LatencyHistogram {
+    private:
+        static constexpr int SUB_BUCKET_BITS = 3;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        std::array<std::atomic<uint64_t>, NUM_BUCKETS> _counts{};
+        std::atomic<uint64_t> _total_ns{0};
+        std::atomic<uint64_t> _max_ns{0};
+
+        static int _bucketFor(uint64_t ns) {
+            if (ns < SUB_BUCKETS) {
+                return static_cast<int>(ns);
+            }
+            const int shift = 63 - __builtin_clzll(ns) - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKETS + static_cast<int>((ns >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        static uint64_t _lowerBound(int bucket) {
+            if (bucket < SUB_BUCKETS) {
+                return bucket;
+            }
+            const int shift = bucket / SUB_BUCKETS - 1;
+            return static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        }
+
+    public:
+        struct Snapshot {
+            uint64_t count = 0;
+            uint64_t total_ns = 0;
+            uint64_t max_ns = 0;
+            // (lower bound in ns, count) of every non-empty bucket, ascending
+            std::vector<std::pair<uint64_t, uint64_t>> buckets;
+
+            // highest value that falls into the same bucket as the given quantile
+            uint64_t percentile(double quantile) const {
+                if (count == 0) {
+                    return 0;
+                }
+                const auto rank = static_cast<uint64_t>(quantile * static_cast<double>(count - 1)) + 1;
+                uint64_t seen = 0;
+                for (std::size_t i = 0; i < buckets.size(); i++) {
+                    seen += buckets[i].second;
+                    if (seen >= rank) {
+                        return std::min(max_ns, _lowerBound(_bucketFor(buckets[i].first) + 1) - 1);
+                    }
+                }
+                return max_ns;
+            }
+        };
+
+        void record(std::chrono::steady_clock::duration duration) {
+            auto ns = static_cast<uint64_t>(std::max<int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+            _counts[_bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+            _total_ns.fetch_add(ns, std::memory_order_relaxed);
+            auto max = _max_ns.load(std::memory_order_relaxed);
+            while (ns > max && !_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+        }
+
+        Snapshot snapshot() const {
+            Snapshot snapshot;
+            for (int i = 0; i < NUM_BUCKETS; i++) {
+                auto count = _counts[i].load(std::memory_order_relaxed);
+                if (count > 0) {
+                    snapshot.count += count;
+                    snapshot.buckets.emplace_back(_lowerBound(i), count);
+                }
+            }
+            snapshot.total_ns = _total_ns.load(std::memory_order_relaxed);
+            snapshot.max_ns = _max_ns.load(std::memory_order_relaxed);
+            return snapshot;
+        }
+    };
+
+    // State the python bindings keep for every Connection, fed from the receive thread
+    struct ConnectionState {
+        // process-wide counter in order of attachment, spreads connections evenly over executor workers
+        const uint64_t id = [] {
+            static std::atomic<uint64_t> next_id{0};
+            return next_id.fetch_add(1, std::memory_order_relaxed);
+        }();
+        // message set of the runtime the connection belongs to, set before python sees the connection
+        std::atomic<const mav::MessageSet*> message_set{nullptr};
+        // interface of that runtime, accessed with std::atomic_load and std::atomic_store
+        std::shared_ptr<LockedInterface> interface;
+        LatestMessageCache latest;
+        TrafficStats stats;
+        SequenceTracker sequence;
+        // from the receive thread handing a message to a MessageQueue until python takes it out
+        LatencyHistogram queue_latency;
+        // from the receive thread entering a python callback until the callback holds the GIL
+        LatencyHistogram dispatch_latency;
+
+        void consume(const Message &message) {
+            stats.recordReceived(message);
+            sequence.update(message);
+            latest.update(message);
+        }
+    };
+
+    // Returns the state of a connection, attaching it on first use.
+    // The state lives as long as the connection holds its message callback.
+    inline std::shared_ptr<ConnectionState> connectionState(const std::shared_ptr<Connection> &connection) {
+        static std::mutex lock;
+        static std::unordered_map<const Connection*, std::weak_ptr<ConnectionState>> states;
+        // expired entries are swept once the table has doubled, so that attaching many partners stays linear
+        static std::size_t sweep_at = 64;
+
+        std::lock_guard lg{lock};
+        auto state = states[connection.get()].lock();
+        if (!state) {
+            if (states.size() >= sweep_at) {
+                for (auto it = states.begin(); it != states.end();) {
+                    it = it->second.expired() ? states.erase(it) : std::next(it);
+                }
+                sweep_at = std::max<std::size_t>(64, 2 * states.size());
+            }
+            state = std::make_shared<ConnectionState>();
+            states[connection.get()] = state;
+            connection->addMessageCallback([state](const Message &message) {
+                state->consume(message);
+            });
+        }
+        return state;
+    }
+}
+
+#endif //LIBMAV_PYTHON_CONNECTIONSTATE_H
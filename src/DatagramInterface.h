@@ -0,0 +1,60 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_DATAGRAMINTERFACE_H
+#define LIBMAV_PYTHON_DATAGRAMINTERFACE_H
+
+#include "mav/Network.h"
+#include "mav/UDPClient.h"
+#include "mav/UDPServer.h"
+#include <stdexcept>
+#include <string>
+
+namespace libmav_python {
+
+    // Frames written straight to an interface bypass the send lock of its NetworkRuntime. That is only
+    // safe where every write is a datagram of its own; on TCP and serial links the bytes could interleave
+    // with the frames of the runtime.
+    inline bool isDatagramInterface(const mav::NetworkInterface &interface) {
+        return dynamic_cast<const mav::UDPServer *>(&interface) || dynamic_cast<const mav::UDPClient *>(&interface);
+    }
+
+    inline void requireDatagramInterface(const mav::NetworkInterface &interface, const std::string &what) {
+        if (!isDatagramInterface(interface)) {
+            throw std::invalid_argument(what + " only supports UDP interfaces");
+        }
+    }
+}
+
+#endif //LIBMAV_PYTHON_DATAGRAMINTERFACE_H
@@ -0,0 +1,66 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_GILRELEASE_H
+#define LIBMAV_PYTHON_GILRELEASE_H
+
+#include <pybind11/pybind11.h>
+#include <optional>
+#include <thread>
+
+namespace libmav_python {
+
+    // Releases the GIL for its lifetime if the calling thread holds it. Destructors run both from python
+    // dealloc and from C++ threads; either way they must not hold the GIL while they wait for a thread or
+    // a callback that might itself be waiting for it.
+    class ReleaseGilIfHeld {
+    private:
+        std::optional<pybind11::gil_scoped_release> _release;
+
+    public:
+        ReleaseGilIfHeld() {
+            if (PyGILState_Check()) {
+                _release.emplace();
+            }
+        }
+    };
+
+    // Joins a helper thread that might itself be waiting for the GIL
+    inline void joinReleasingGil(std::thread &thread) {
+        ReleaseGilIfHeld release;
+        thread.join();
+    }
+}
+
+#endif //LIBMAV_PYTHON_GILRELEASE_H
@@ -0,0 +1,81 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_LOCKEDINTERFACE_H
+#define LIBMAV_PYTHON_LOCKEDINTERFACE_H
+
+#include "mav/Network.h"
+#include <mutex>
+
+namespace libmav_python {
+
+    // The interface a NetworkRuntime is constructed on. Every write goes through one lock, so that
+    // frames the bindings write to the link directly, such as forwarded ones, never interleave with
+    // the frames of the runtime on stream interfaces like TCP and serial.
+    class LockedInterface : public mav::NetworkInterface {
+    private:
+        mav::NetworkInterface &_interface;
+        std::mutex _send_lock;
+
+    public:
+        explicit LockedInterface(mav::NetworkInterface &interface) : _interface(interface) {}
+
+        const mav::NetworkInterface &inner() const {
+            return _interface;
+        }
+
+        void close() const override {
+            _interface.close();
+        }
+
+        bool isConnectionOriented() const override {
+            return _interface.isConnectionOriented();
+        }
+
+        void markMessageBoundary() override {
+            _interface.markMessageBoundary();
+        }
+
+        mav::ConnectionPartner receive(uint8_t *destination, uint32_t size) override {
+            return _interface.receive(destination, size);
+        }
+
+        void send(const uint8_t *data, uint32_t size, mav::ConnectionPartner target) override {
+            std::lock_guard lg{_send_lock};
+            _interface.send(data, size, target);
+        }
+    };
+}
+
+#endif //LIBMAV_PYTHON_LOCKEDINTERFACE_H
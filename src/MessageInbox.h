@@ -0,0 +1,107 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_MESSAGEINBOX_H
+#define LIBMAV_PYTHON_MESSAGEINBOX_H
+
+#include "mav/Connection.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace libmav_python {
+
+    using mav::CallbackHandle;
+    using mav::Connection;
+    using mav::Message;
+
+    // Collects the messages that pass a filter on the receive thread for as long as it lives,
+    // so that a protocol engine can wait for replies without missing one between two waits
+    class MessageInbox {
+    private:
+        struct Shared {
+            std::function<bool(const Message &)> filter;
+            std::mutex lock;
+            std::condition_variable cv;
+            std::deque<Message> messages;
+        };
+
+        std::shared_ptr<Connection> _connection;
+        std::shared_ptr<Shared> _shared;
+        CallbackHandle _handle;
+
+    public:
+        MessageInbox(std::shared_ptr<Connection> connection, std::function<bool(const Message &)> filter) :
+                _connection(std::move(connection)), _shared(std::make_shared<Shared>()) {
+            _shared->filter = std::move(filter);
+            _handle = _connection->addMessageCallback([shared = _shared](const Message &message) {
+                if (!shared->filter(message)) {
+                    return;
+                }
+                {
+                    std::lock_guard lg{shared->lock};
+                    shared->messages.push_back(message);
+                }
+                shared->cv.notify_all();
+            });
+        }
+
+        MessageInbox(const MessageInbox &) = delete;
+        MessageInbox &operator=(const MessageInbox &) = delete;
+
+        ~MessageInbox() {
+            _connection->removeMessageCallback(_handle);
+        }
+
+        std::optional<Message> next(std::chrono::steady_clock::time_point deadline) {
+            std::unique_lock lk{_shared->lock};
+            if (!_shared->cv.wait_until(lk, deadline, [this] { return !_shared->messages.empty(); })) {
+                return std::nullopt;
+            }
+            Message message = _shared->messages.front();
+            _shared->messages.pop_front();
+            return message;
+        }
+
+        std::optional<Message> next(int timeout_ms) {
+            return next(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms));
+        }
+    };
+}
+
+#endif //LIBMAV_PYTHON_MESSAGEINBOX_H
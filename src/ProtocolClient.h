@@ -0,0 +1,140 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#ifndef LIBMAV_PYTHON_PROTOCOLCLIENT_H
+#define LIBMAV_PYTHON_PROTOCOLCLIENT_H
+
+#include <pybind11/pybind11.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include <cerrno>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <unistd.h>
+
+namespace libmav_python {
+
+    // The state shared by the clients of the MAVLink microservices: the component they talk to,
+    // and sending with the traffic accounting of the connection
+    class ProtocolClient {
+    public:
+        ProtocolClient(std::shared_ptr<mav::Connection> connection, const mav::MessageSet &message_set,
+                       int target_system, int target_component) :
+                _connection(std::move(connection)),
+                _state(connectionState(_connection)),
+                _message_set(message_set),
+                _target_system(target_system),
+                _target_component(target_component) {}
+
+    protected:
+        std::shared_ptr<mav::Connection> _connection;
+        std::shared_ptr<ConnectionState> _state;
+        const mav::MessageSet &_message_set;
+        const int _target_system;
+        const int _target_component;
+
+        bool _fromTarget(const mav::Message &message) const {
+            return (_target_system == 0 || message.header().systemId() == _target_system) &&
+                   (_target_component == 0 || message.header().componentId() == _target_component);
+        }
+
+        // a message addressed to the target component
+        mav::Message _create(const std::string &name) const {
+            auto message = _message_set.create(name);
+            message.set("target_system", static_cast<uint8_t>(_target_system));
+            message.set("target_component", static_cast<uint8_t>(_target_component));
+            return message;
+        }
+
+        void _send(mav::Message &message) {
+            _connection->send(message);
+            _state->stats.recordSent(message);
+        }
+    };
+
+    // Runs a cleanup, such as removing a callback or closing a file descriptor, when it goes out of scope
+    template <typename Cleanup>
+    class ScopeExit {
+    private:
+        Cleanup _cleanup;
+
+    public:
+        explicit ScopeExit(Cleanup cleanup) : _cleanup(std::move(cleanup)) {}
+
+        ScopeExit(const ScopeExit &) = delete;
+        ScopeExit &operator=(const ScopeExit &) = delete;
+
+        ~ScopeExit() {
+            _cleanup();
+        }
+    };
+
+    // Writes a downloaded chunk at its offset. pwrite() may write less than asked, for example when a signal
+    // interrupts it, so it is repeated until the whole chunk is written.
+    inline void writeAt(int fd, const uint8_t *data, uint32_t length, off_t offset) {
+        while (length > 0) {
+            const ssize_t written = ::pwrite(fd, data, length, offset);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw std::runtime_error("Could not write to file descriptor");
+            }
+            data += written;
+            length -= static_cast<uint32_t>(written);
+            offset += written;
+        }
+    }
+
+    // Chunks arrive out of order and are written at their offset, which pipes, sockets and terminals do not support
+    inline void requireSeekable(int fd) {
+        if (::lseek(fd, 0, SEEK_CUR) < 0) {
+            throw std::invalid_argument("File descriptor is not seekable, downloads need a file");
+        }
+    }
+
+    // Binds the constructor of a protocol client. The client refers to the message set, so it is kept alive with it.
+    template <typename Client>
+    pybind11::class_<Client> bindProtocolClient(pybind11::class_<Client> cls) {
+        namespace py = pybind11;
+        return cls.def(py::init<std::shared_ptr<mav::Connection>, const mav::MessageSet &, int, int>(),
+                       py::keep_alive<1, 3>(), py::arg("connection"), py::arg("message_set"),
+                       py::arg("target_system") = 1, py::arg("target_component") = 1);
+    }
+}
+
+#endif //LIBMAV_PYTHON_PROTOCOLCLIENT_H
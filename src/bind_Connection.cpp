@@ -36,30 +36,431 @@
 #include <pybind11/functional.h>
 #include <pybind11/stl.h>
 #include "mav/Connection.h"
+#include "ConnectionState.h"
+#include "GilRelease.h"
+#include "MessageInbox.h"
 #include <queue>
+#include <deque>
 #include <mutex>
 #include <optional>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <variant>
+#include <type_traits>
+#include <unordered_map>
+#include <map>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 namespace py = pybind11;
 using namespace mav;
+using namespace libmav_python;
+
+// Created by each receive_any() call and shared by the expectations it waits on
+struct ExpectationWaiter {
+    std::mutex lock;
+    std::condition_variable cv;
+};
+
+struct ExpectationResult {
+    std::mutex lock;
+    // copy of the matching message, set on the receive thread
+    std::optional<Message> message;
+    // woken up once the message is set, while a receive_any() call waits on this expectation
+    std::shared_ptr<ExpectationWaiter> waiter;
+};
 
 struct _ExpectationWrapper {
     Connection::Expectation expectation;
+    std::shared_ptr<ExpectationResult> result = std::make_shared<ExpectationResult>();
+};
+
+static bool matchesSender(const Message &message, int source_id, int component_id) {
+    return (source_id == mav::ANY_ID || message.header().systemId() == source_id) &&
+           (component_id == mav::ANY_ID || message.header().componentId() == component_id);
+}
+
+// Field equality constraint of an expectation, evaluated on the receive thread
+struct FieldPredicate {
+    using Value = std::variant<int64_t, uint64_t, double, std::string>;
+    std::string field;
+    Value value;
+};
+
+// Empty message of the given id or name, if the runtime of the connection knows it
+template <typename Key>
+static std::optional<Message> prototype(const std::shared_ptr<Connection> &connection, const Key &key) {
+    const MessageSet *message_set = connectionState(connection)->message_set;
+    if (!message_set || !message_set->contains(key)) {
+        return std::nullopt;
+    }
+    return message_set->create(key);
+}
+
+// Parses the `where` argument of an expectation, None for no constraint. Field names and value types are
+// checked against the message definition up front, so that a typo raises instead of never matching.
+static std::vector<FieldPredicate> fieldPredicates(const std::optional<py::dict> &where,
+                                                   const std::optional<Message> &prototype) {
+    std::vector<FieldPredicate> predicates;
+    if (!where) {
+        return predicates;
+    }
+    for (auto item : *where) {
+        FieldPredicate predicate{item.first.cast<std::string>(), {}};
+        if (prototype) {
+            const auto &definition = prototype->type();
+            if (!definition.containsField(predicate.field)) {
+                throw py::key_error("where: message '" + definition.name() + "' has no field '" +
+                                    predicate.field + "'");
+            }
+            const auto &type = definition.fieldForName(predicate.field).type;
+            const bool is_text = type.base_type == BaseType::CHAR;
+            if (!is_text && type.size > 1) {
+                throw py::type_error("where: field '" + predicate.field +
+                                     "' is an array, only single values can be compared");
+            }
+            if (is_text != py::isinstance<py::str>(item.second)) {
+                throw py::type_error("where: value of field '" + predicate.field + "' must be " +
+                                     (is_text ? "a str" : "an int or float"));
+            }
+        }
+        if (py::isinstance<py::str>(item.second)) {
+            predicate.value = item.second.cast<std::string>();
+        } else if (py::isinstance<py::float_>(item.second)) {
+            predicate.value = item.second.cast<double>();
+        } else if (py::isinstance<py::int_>(item.second)) {
+            auto value = item.second.cast<py::int_>();
+            if (value < py::int_(0)) {
+                predicate.value = value.cast<int64_t>();
+            } else {
+                predicate.value = value.cast<uint64_t>();
+            }
+        } else {
+            throw py::type_error("where: value of field '" + predicate.field + "' must be an int, float or str");
+        }
+        predicates.push_back(std::move(predicate));
+    }
+    return predicates;
+}
+
+template <typename A, typename B>
+static bool numbersEqual(A a, B b) {
+    // float fields are compared at their own precision, so that 0.1 matches the float32 closest to it
+    if constexpr (std::is_same_v<A, float> || std::is_same_v<B, float>) {
+        return static_cast<float>(a) == static_cast<float>(b);
+    } else if constexpr (std::is_floating_point_v<A> || std::is_floating_point_v<B>) {
+        return static_cast<double>(a) == static_cast<double>(b);
+    } else if constexpr (std::is_signed_v<A> == std::is_signed_v<B>) {
+        return a == b;
+    } else if constexpr (std::is_signed_v<A>) {
+        return a >= 0 && static_cast<std::make_unsigned_t<A>>(a) == b;
+    } else {
+        return b >= 0 && a == static_cast<std::make_unsigned_t<B>>(b);
+    }
+}
+
+static bool matchesFields(const Message &message, const std::vector<FieldPredicate> &predicates) {
+    for (const auto &predicate : predicates) {
+        NativeVariantType field_value;
+        try {
+            field_value = message.getAsNativeTypeInVariant(predicate.field);
+        } catch (const std::exception &) {
+            // only for messages unknown to the runtime, the fields of known ones were checked up front
+            return false;
+        }
+        bool equal = std::visit([](const auto &actual, const auto &expected) {
+            using A = std::decay_t<decltype(actual)>;
+            using B = std::decay_t<decltype(expected)>;
+            if constexpr (std::is_arithmetic_v<A> && std::is_arithmetic_v<B>) {
+                return numbersEqual(actual, expected);
+            } else if constexpr (std::is_same_v<A, std::string> && std::is_same_v<B, std::string>) {
+                return actual == expected;
+            } else {
+                return false;
+            }
+        }, field_value, predicate.value);
+        if (!equal) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static _ExpectationWrapper makeExpectation(Connection &connection, std::function<bool(const Message &)> selector) {
+    _ExpectationWrapper wrapper;
+    wrapper.expectation = connection.expect([selector = std::move(selector), result = wrapper.result]
+            (const Message &message) {
+        if (!selector(message)) {
+            return false;
+        }
+        std::shared_ptr<ExpectationWaiter> waiter;
+        {
+            std::lock_guard lg{result->lock};
+            result->message = message;
+            waiter = result->waiter;
+        }
+        if (waiter) {
+            // taking the lock orders the notification after the waiter's last check
+            { std::lock_guard lg{waiter->lock}; }
+            waiter->cv.notify_one();
+        }
+        return true;
+    });
+    return wrapper;
+}
+
+// File descriptor that can be polled for readability, e.g. with select or asyncio's loop.add_reader.
+// Backed by an eventfd on linux and by a pipe elsewhere.
+class WakeupFd {
+private:
+    int _read_fd = -1;
+    int _write_fd = -1;
+public:
+    WakeupFd() {
+#ifdef __linux__
+        _read_fd = _write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_read_fd < 0) {
+            throw std::runtime_error("Could not create eventfd");
+        }
+#else
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error("Could not create pipe");
+        }
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        _read_fd = fds[0];
+        _write_fd = fds[1];
+#endif
+    }
+
+    WakeupFd(const WakeupFd &) = delete;
+    WakeupFd &operator=(const WakeupFd &) = delete;
+
+    ~WakeupFd() {
+        ::close(_read_fd);
+        if (_write_fd != _read_fd) {
+            ::close(_write_fd);
+        }
+    }
+
+    int fd() const {
+        return _read_fd;
+    }
+
+    void set() {
+        uint64_t one = 1;
+        if (::write(_write_fd, &one, sizeof(one)) < 0) {
+            // already signalled
+        }
+    }
+
+    void clear() {
+        uint64_t buf;
+        while (::read(_read_fd, &buf, sizeof(buf)) > 0) {}
+    }
+};
+
+// State of a connection, cached on its python object so that frequent calls skip the registry
+// of connectionState(). Needs the GIL.
+static std::shared_ptr<ConnectionState> cachedState(const py::object &connection) {
+    if (py::hasattr(connection, "_state")) {
+        return connection.attr("_state").cast<std::shared_ptr<ConnectionState>>();
+    }
+    auto state = connectionState(connection.cast<std::shared_ptr<Connection>>());
+    connection.attr("_state") = state;
+    return state;
+}
+
+// Message together with the time the receive thread handed it to the bindings
+struct ReceivedMessage {
+    Message message;
+    std::chrono::steady_clock::time_point receive_time;
+};
+
+// Stamps messages as they come off the receive thread
+static std::function<void(const Message &)> stamped(std::function<void(const ReceivedMessage &)> consumer) {
+    return [consumer = std::move(consumer)](const Message &message) {
+        consumer({message, std::chrono::steady_clock::now()});
+    };
+}
+
+// Python copy of a received message, with the receive time in Message.receive_time_ns. Needs the GIL.
+static py::object toPython(const ReceivedMessage &received) {
+    py::object message = py::cast(received.message);
+    message.attr("receive_time_ns") = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            received.receive_time.time_since_epoch()).count();
+    return message;
+}
+
+static py::object toPython(const std::vector<ReceivedMessage> &received) {
+    py::list messages;
+    for (const auto &message : received) {
+        messages.append(toPython(message));
+    }
+    return std::move(messages);
+}
+
+// Limits the rate of messages per message id. Within each window either the first message is passed on
+// right away ("first"), or the first and then the newest one at the end of the window ("latest").
+class RateLimiter {
+private:
+    struct Window {
+        std::chrono::steady_clock::time_point end;
+        std::optional<ReceivedMessage> held;
+    };
+
+    std::function<void(const ReceivedMessage &)> _emit;
+    const std::chrono::steady_clock::duration _period;
+    const bool _keep_latest;
+    std::unordered_map<int, Window> _windows;
+    std::mutex _lock;
+    // serializes emission from the receive thread and the flush thread, so messages stay in order
+    std::mutex _emit_lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+    std::thread _thread;
+
+    void _run() {
+        std::unique_lock lk{_lock};
+        while (!_stop) {
+            auto now = std::chrono::steady_clock::now();
+            auto next_flush = std::chrono::steady_clock::time_point::max();
+            for (auto &[id, window] : _windows) {
+                if (!window.held) {
+                    continue;
+                }
+                if (window.end <= now) {
+                    ReceivedMessage message = std::move(*window.held);
+                    window.held.reset();
+                    window.end += _period;
+                    // same lock order as offer(), and _emit_lock is released before _lock is taken again
+                    std::unique_lock el{_emit_lock};
+                    lk.unlock();
+                    try {
+                        _emit(message);
+                    } catch (py::error_already_set &e) {
+                        py::gil_scoped_acquire acquire;
+                        e.discard_as_unraisable("libmav rate limited callback");
+                    }
+                    el.unlock();
+                    lk.lock();
+                    // windows might have changed while unlocked
+                    next_flush = now;
+                    break;
+                }
+                next_flush = std::min(next_flush, window.end);
+            }
+            if (next_flush == std::chrono::steady_clock::time_point::max()) {
+                _cv.wait(lk);
+            } else if (next_flush > now) {
+                _cv.wait_until(lk, next_flush);
+            }
+        }
+    }
+
+    static std::chrono::steady_clock::duration _periodFor(double max_rate_hz) {
+        if (!(max_rate_hz > 0)) {
+            throw std::invalid_argument("max_rate_hz must be positive");
+        }
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(1.0 / max_rate_hz));
+    }
+
+    static bool _keepLatest(const std::string &keep) {
+        if (keep != "latest" && keep != "first") {
+            throw std::invalid_argument("keep must be 'latest' or 'first'");
+        }
+        return keep == "latest";
+    }
+
+public:
+    RateLimiter(std::function<void(const ReceivedMessage &)> emit, double max_rate_hz, const std::string &keep) :
+            _emit(std::move(emit)),
+            _period(_periodFor(max_rate_hz)),
+            _keep_latest(_keepLatest(keep)) {
+        if (_keep_latest) {
+            _thread = std::thread{&RateLimiter::_run, this};
+        }
+    }
+
+    ~RateLimiter() {
+        if (_thread.joinable()) {
+            {
+                std::lock_guard lg{_lock};
+                _stop = true;
+            }
+            _cv.notify_all();
+            joinReleasingGil(_thread);
+        }
+    }
+
+    void offer(const ReceivedMessage &message) {
+        auto now = std::chrono::steady_clock::now();
+        std::unique_lock lk{_lock};
+        auto &window = _windows[message.message.id()];
+        if (now < window.end) {
+            if (_keep_latest) {
+                bool first_held = !window.held;
+                window.held = message;
+                if (first_held) {
+                    _cv.notify_one();
+                }
+            }
+            return;
+        }
+        // window is over, a held message is superseded by this one
+        window.held.reset();
+        window.end = now + _period;
+        std::lock_guard el{_emit_lock};
+        lk.unlock();
+        _emit(message);
+    }
 };
 
 // Class to queue incoming messages from a Connection to be accessed asynchronously by python
 class MessageQueue {
 private:
-    std::queue<Message> _messages;
+    std::queue<ReceivedMessage> _messages;
     std::mutex _lock;
+    WakeupFd _wakeup;
     std::weak_ptr<Connection> _connection;
+    std::shared_ptr<ConnectionState> _state;
     CallbackHandle _cb_handle;
+    // declared last, so that its flush thread stops before the queue goes away
+    std::unique_ptr<RateLimiter> _rate_limiter;
+
+    void _push(const ReceivedMessage &message) {
+        std::lock_guard lg{_lock};
+        if (_messages.empty()) {
+            _wakeup.set();
+        }
+        _messages.push(message);
+        _state->stats.recordQueueDepth(_messages.size());
+    }
+
 public:
-    MessageQueue(std::shared_ptr<Connection> &connection) : _connection(connection) {
-        _cb_handle = connection->addMessageCallback([this](const Message &message) {
-            std::lock_guard lg{_lock};
-            _messages.push(message);
-        });
+    MessageQueue(std::shared_ptr<Connection> &connection, double rate = 0, const std::string &keep = "latest") :
+            _connection(connection), _state(connectionState(connection)) {
+        if (rate > 0) {
+            _rate_limiter = std::make_unique<RateLimiter>([this](const ReceivedMessage &message) {
+                _push(message);
+            }, rate, keep);
+            _cb_handle = connection->addMessageCallback(stamped([this](const ReceivedMessage &message) {
+                _rate_limiter->offer(message);
+            }));
+        } else {
+            _cb_handle = connection->addMessageCallback(stamped([this](const ReceivedMessage &message) {
+                _push(message);
+            }));
+        }
     }
 
     ~MessageQueue() {
@@ -69,13 +470,17 @@ public:
         }
     }
 
-    std::optional<Message> next() {
+    std::optional<ReceivedMessage> next() {
         std::lock_guard lg{_lock};
         if (_messages.empty()) {
             return std::nullopt;
         }
-        const Message ret = _messages.front();
+        const ReceivedMessage ret = _messages.front();
+        _state->queue_latency.record(std::chrono::steady_clock::now() - ret.receive_time);
         _messages.pop();
+        if (_messages.empty()) {
+            _wakeup.clear();
+        }
         return ret;
     }
 
@@ -83,56 +488,801 @@ public:
         std::lock_guard lg{_lock};
         return _messages.size();
     }
+
+    // readable while the queue is not empty
+    int fileno() const {
+        return _wakeup.fd();
+    }
+};
+
+// Resolves an asyncio future from the receive thread once a matching message arrives
+struct AsyncExpectation {
+    std::function<bool(const Message &)> selector;
+    std::atomic<bool> matched{false};
+    py::object loop;
+    py::object future;
+
+    ~AsyncExpectation() {
+        py::gil_scoped_acquire acquire;
+        py::object kill_loop(std::move(loop));
+        py::object kill_future(std::move(future));
+    }
+};
+
+static py::object expectAsync(const std::shared_ptr<Connection> &connection,
+                              std::function<bool(const Message &)> selector) {
+    auto expectation = std::make_shared<AsyncExpectation>();
+    expectation->selector = std::move(selector);
+    expectation->loop = py::module::import("asyncio").attr("get_running_loop")();
+    expectation->future = expectation->loop.attr("create_future")();
+    py::object future = expectation->future;
+
+    CallbackHandle handle;
+    {
+        py::gil_scoped_release release;
+        handle = connection->addMessageCallback([expectation](const Message &message) {
+            if (expectation->matched || !expectation->selector(message)) {
+                return;
+            }
+            expectation->matched = true;
+            py::gil_scoped_acquire acquire;
+            // the loop may have been closed without the future being cancelled
+            if (expectation->loop.attr("is_closed")().cast<bool>()) {
+                return;
+            }
+            py::object future = expectation->future;
+            try {
+                expectation->loop.attr("call_soon_threadsafe")(py::cpp_function([future](const Message &message) {
+                    if (!future.attr("done")().cast<bool>()) {
+                        future.attr("set_result")(message);
+                    }
+                }), message);
+            } catch (py::error_already_set &e) {
+                // closed between the check and the call
+                e.discard_as_unraisable("libmav expect_async");
+            }
+        });
+    }
+
+    // the message callback is dropped once the future is resolved or cancelled
+    std::weak_ptr<Connection> weak_connection = connection;
+    future.attr("add_done_callback")(py::cpp_function([weak_connection, handle](const py::object &) {
+        py::gil_scoped_release release;
+        auto connection = weak_connection.lock();
+        if (connection) {
+            connection->removeMessageCallback(handle);
+        }
+    }));
+    return future;
+}
+
+// Wraps a python callback so that the time spent waiting for the GIL shows up in Connection.latency()
+// and the time spent in the callback itself in Connection.stats()
+template <typename Arg>
+static std::function<void(const Arg &)> timedCallback(const std::shared_ptr<Connection> &connection,
+                                                     std::function<void(py::object)> callback) {
+    return [state = connectionState(connection), callback = std::move(callback)](const Arg &arg) {
+        auto dispatched = std::chrono::steady_clock::now();
+        py::gil_scoped_acquire acquire;
+        auto start = std::chrono::steady_clock::now();
+        state->dispatch_latency.record(start - dispatched);
+        callback(toPython(arg));
+        state->stats.recordCallback(std::chrono::steady_clock::now() - start);
+    };
+}
+
+// Collects messages from the receive thread and hands them to python as a list, so that the GIL
+// is acquired once per batch instead of once per message
+class BatchCallback {
+private:
+    std::function<void(const std::vector<ReceivedMessage> &)> _callback;
+    const std::size_t _max_batch;
+    const std::chrono::milliseconds _max_latency;
+    std::vector<ReceivedMessage> _pending;
+    std::chrono::steady_clock::time_point _oldest_pending;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _stop = false;
+    std::thread _thread;
+
+    void _run() {
+        std::vector<ReceivedMessage> batch;
+        std::unique_lock lk{_lock};
+        while (true) {
+            _cv.wait(lk, [this] { return _stop || !_pending.empty(); });
+            _cv.wait_until(lk, _oldest_pending + _max_latency, [this] {
+                return _stop || _pending.size() >= _max_batch;
+            });
+            // on stop, what is still pending is delivered as one last batch
+            if (_pending.empty()) {
+                return;
+            }
+            batch.swap(_pending);
+            _pending.reserve(_max_batch);
+            lk.unlock();
+            try {
+                _callback(batch);
+            } catch (py::error_already_set &e) {
+                py::gil_scoped_acquire acquire;
+                e.discard_as_unraisable("libmav batch callback");
+            }
+            batch.clear();
+            lk.lock();
+        }
+    }
+
+public:
+    BatchCallback(std::function<void(const std::vector<ReceivedMessage> &)> callback,
+                  std::size_t max_batch, int max_latency_ms) :
+            _callback(std::move(callback)),
+            _max_batch(std::max<std::size_t>(max_batch, 1)),
+            _max_latency(std::max(max_latency_ms, 0)) {
+        _pending.reserve(_max_batch);
+        _thread = std::thread{&BatchCallback::_run, this};
+    }
+
+    ~BatchCallback() {
+        {
+            std::lock_guard lg{_lock};
+            _stop = true;
+        }
+        _cv.notify_all();
+        joinReleasingGil(_thread);
+    }
+
+    void push(const ReceivedMessage &message) {
+        std::size_t size;
+        {
+            std::lock_guard lg{_lock};
+            if (_pending.empty()) {
+                _oldest_pending = std::chrono::steady_clock::now();
+            }
+            _pending.push_back(message);
+            size = _pending.size();
+        }
+        if (size == 1 || size >= _max_batch) {
+            _cv.notify_one();
+        }
+    }
+};
+
+// Runs message callbacks on a pool of worker threads, so that the receive thread only parses and hands off.
+// Tasks with the same ordering key always go to the same worker, which keeps them in order. Every worker
+// queues at most max_pending tasks, further ones are dropped and counted.
+class CallbackExecutor {
+private:
+    struct Worker {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+        std::condition_variable cv;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    const std::size_t _max_pending;
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<bool> _stop{false};
+
+    void _run(Worker &worker) {
+        std::unique_lock lk{worker.lock};
+        while (true) {
+            worker.cv.wait(lk, [this, &worker] { return _stop || !worker.tasks.empty(); });
+            // pending tasks are still run on shutdown
+            if (worker.tasks.empty()) {
+                return;
+            }
+            auto task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            lk.unlock();
+            try {
+                task();
+            } catch (py::error_already_set &e) {
+                py::gil_scoped_acquire acquire;
+                e.discard_as_unraisable("libmav callback executor");
+            } catch (const std::exception &e) {
+                py::gil_scoped_acquire acquire;
+                PyErr_SetString(PyExc_RuntimeError, e.what());
+                py::error_already_set().discard_as_unraisable("libmav callback executor");
+            }
+            task = nullptr;
+            lk.lock();
+        }
+    }
+
+public:
+    CallbackExecutor(std::size_t threads, std::size_t max_pending) : _max_pending(max_pending) {
+        if (threads == 0) {
+            throw std::invalid_argument("threads must be at least 1");
+        }
+        if (max_pending == 0) {
+            throw std::invalid_argument("max_pending must be at least 1");
+        }
+        for (std::size_t i = 0; i < threads; i++) {
+            _workers.push_back(std::make_unique<Worker>());
+        }
+        for (auto &worker : _workers) {
+            worker->thread = std::thread{&CallbackExecutor::_run, this, std::ref(*worker)};
+        }
+    }
+
+    ~CallbackExecutor() {
+        for (auto &worker : _workers) {
+            {
+                std::lock_guard lg{worker->lock};
+                _stop = true;
+            }
+            worker->cv.notify_all();
+        }
+        for (auto &worker : _workers) {
+            joinReleasingGil(worker->thread);
+        }
+    }
+
+    void submit(std::size_t key, std::function<void()> task) {
+        auto &worker = *_workers[key % _workers.size()];
+        {
+            std::lock_guard lg{worker.lock};
+            if (worker.tasks.size() >= _max_pending) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            worker.tasks.push_back(std::move(task));
+        }
+        worker.cv.notify_one();
+    }
+
+    std::size_t threads() const {
+        return _workers.size();
+    }
+
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    std::size_t pending() {
+        std::size_t pending = 0;
+        for (auto &worker : _workers) {
+            std::lock_guard lg{worker->lock};
+            pending += worker->tasks.size();
+        }
+        return pending;
+    }
 };
 
+// Merges connections that carry the same traffic over redundant links. Every frame is delivered once,
+// the first time it arrives on any link; later copies are recognized by (system id, component id,
+// sequence, message id) within a sliding window per sender.
+class RedundantLinkGroup {
+public:
+    struct LinkStats {
+        uint64_t received = 0;
+        uint64_t first = 0;
+        uint64_t duplicates = 0;
+        // how much later than the first copy the duplicates arrived
+        uint64_t delay_ns = 0;
+    };
+
+private:
+    struct Seen {
+        uint32_t key;
+        std::size_t link;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    std::vector<std::shared_ptr<Connection>> _connections;
+    std::vector<CallbackHandle> _handles;
+    const std::size_t _window;
+    std::mutex _lock;
+    // per sender, the most recent frames, oldest first
+    std::unordered_map<uint16_t, std::deque<Seen>> _seen;
+    std::vector<LinkStats> _stats;
+    std::mutex _callbacks_lock;
+    std::map<CallbackHandle, std::function<void(py::object)>> _callbacks;
+    CallbackHandle _next_handle = 0;
+
+    void _offer(std::size_t link, const ReceivedMessage &received) {
+        auto header = received.message.header();
+        const uint32_t key = (static_cast<uint32_t>(header.seq()) << 24) | static_cast<uint32_t>(received.message.id());
+        {
+            std::lock_guard lg{_lock};
+            auto &stats = _stats[link];
+            stats.received++;
+            auto &seen = _seen[static_cast<uint16_t>((header.systemId() << 8) | header.componentId())];
+            auto it = std::find_if(seen.begin(), seen.end(), [key](const Seen &entry) { return entry.key == key; });
+            if (it != seen.end()) {
+                stats.duplicates++;
+                stats.delay_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        received.receive_time - it->time).count());
+                return;
+            }
+            stats.first++;
+            if (seen.size() >= _window) {
+                seen.pop_front();
+            }
+            seen.push_back({key, link, received.receive_time});
+        }
+        {
+            std::lock_guard lg{_callbacks_lock};
+            if (_callbacks.empty()) {
+                return;
+            }
+        }
+        py::gil_scoped_acquire acquire;
+        // copied (under the GIL, as copies own Python references) so that callbacks run unlocked and
+        // may add or remove callbacks of this group themselves
+        std::vector<std::function<void(py::object)>> callbacks;
+        {
+            std::lock_guard lg{_callbacks_lock};
+            callbacks.reserve(_callbacks.size());
+            for (auto &[handle, callback] : _callbacks) {
+                callbacks.push_back(callback);
+            }
+        }
+        py::object message = toPython(received);
+        for (auto &callback : callbacks) {
+            try {
+                callback(message);
+            } catch (py::error_already_set &e) {
+                e.discard_as_unraisable("libmav redundant link group callback");
+            }
+        }
+    }
+
+    static std::size_t _windowFor(std::size_t window) {
+        if (window == 0) {
+            throw std::invalid_argument("window must be at least 1");
+        }
+        return window;
+    }
+
+public:
+    RedundantLinkGroup(std::vector<std::shared_ptr<Connection>> connections, std::size_t window) :
+            _connections(std::move(connections)), _window(_windowFor(window)), _stats(_connections.size()) {
+        for (std::size_t i = 0; i < _connections.size(); i++) {
+            _handles.push_back(_connections[i]->addMessageCallback(stamped([this, i](const ReceivedMessage &received) {
+                _offer(i, received);
+            })));
+        }
+    }
+
+    ~RedundantLinkGroup() {
+        // an in-flight delivery might be waiting for the GIL
+        ReleaseGilIfHeld release;
+        for (std::size_t i = 0; i < _connections.size(); i++) {
+            _connections[i]->removeMessageCallback(_handles[i]);
+        }
+    }
+
+    CallbackHandle addMessageCallback(std::function<void(py::object)> callback) {
+        std::lock_guard lg{_callbacks_lock};
+        _callbacks.emplace(_next_handle, std::move(callback));
+        return _next_handle++;
+    }
+
+    void removeMessageCallback(CallbackHandle handle) {
+        std::function<void(py::object)> removed;
+        {
+            std::lock_guard lg{_callbacks_lock};
+            auto it = _callbacks.find(handle);
+            if (it == _callbacks.end()) {
+                return;
+            }
+            removed = std::move(it->second);
+            _callbacks.erase(it);
+        }
+    }
+
+    std::vector<LinkStats> stats() {
+        std::lock_guard lg{_lock};
+        return _stats;
+    }
+};
+
+// Runs the MAVLink command protocol: sends the command and waits for the matching COMMAND_ACK,
+// resending with an incremented confirmation field on timeout. Once a MAV_RESULT_IN_PROGRESS ack
+// arrived the vehicle is executing the command, so it is never resent: each progress ack restarts
+// the wait, and a timeout after one ends the command. Returns the final ack.
+static Message runCommand(const std::shared_ptr<Connection> &connection, Message command,
+                          int retries, int timeout_ms) {
+    constexpr uint8_t MAV_RESULT_IN_PROGRESS = 5;
+    const uint16_t command_id = command.get<uint16_t>("command");
+    const int target_system = command.get<uint8_t>("target_system");
+    const int target_component = command.get<uint8_t>("target_component");
+    const bool has_confirmation = command.type().containsField("confirmation");
+
+    MessageInbox acks(connection, [command_id, target_system, target_component](const Message &message) {
+        return message.name() == "COMMAND_ACK" && message.get<uint16_t>("command") == command_id &&
+               (target_system == 0 || message.header().systemId() == target_system) &&
+               (target_component == 0 || message.header().componentId() == target_component);
+    });
+
+    auto state = connectionState(connection);
+    for (int attempt = 0; attempt <= retries; attempt++) {
+        if (has_confirmation) {
+            command.set("confirmation", static_cast<uint8_t>(std::min(attempt, 255)));
+        }
+        connection->send(command);
+        state->stats.recordSent(command);
+
+        bool in_progress = false;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (auto ack = acks.next(deadline)) {
+            if (ack->get<uint8_t>("result") != MAV_RESULT_IN_PROGRESS) {
+                return *ack;
+            }
+            in_progress = true;
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        }
+        if (in_progress) {
+            throw TimeoutException("No final COMMAND_ACK for command " + std::to_string(command_id) +
+                                   " after MAV_RESULT_IN_PROGRESS");
+        }
+    }
+    throw TimeoutException("No COMMAND_ACK for command " + std::to_string(command_id));
+}
+
 
 void bind_Connection(py::module m) {
     py::class_<_ExpectationWrapper>(m, "_ExpectationWrapper")
             .def(py::init<>());
 
     py::class_<MessageQueue>(m, "MessageQueue")
-            .def(py::init<std::shared_ptr<Connection> &>())
-            .def("next", &MessageQueue::next, py::call_guard<py::gil_scoped_release>())
+            .def(py::init<std::shared_ptr<Connection> &, double, const std::string &>(),
+                 py::arg("connection"), py::arg("rate") = 0, py::arg("keep") = "latest")
+            .def("next", [](MessageQueue &self) -> py::object {
+                std::optional<ReceivedMessage> msg;
+                {
+                    py::gil_scoped_release release;
+                    msg = self.next();
+                }
+                return msg ? toPython(*msg) : py::none();
+            })
             .def("__iter__", [](MessageQueue &self) -> MessageQueue & { return self; })
             .def("__next__", [](MessageQueue &self) {
-                py::gil_scoped_release release;
-                auto msg = self.next();
+                std::optional<ReceivedMessage> msg;
+                {
+                    py::gil_scoped_release release;
+                    msg = self.next();
+                }
                 if (!msg) {
                     throw py::stop_iteration();
                 }
-                return *msg;
+                return toPython(*msg);
+            })
+            .def("__len__", &MessageQueue::size, py::call_guard<py::gil_scoped_release>())
+            .def("fileno", &MessageQueue::fileno)
+            .def("receive_async", [](py::object self_obj) {
+                auto &self = self_obj.cast<MessageQueue &>();
+                py::object loop = py::module::import("asyncio").attr("get_running_loop")();
+                py::object future = loop.attr("create_future")();
+                std::optional<ReceivedMessage> message;
+                {
+                    py::gil_scoped_release release;
+                    message = self.next();
+                }
+                if (message) {
+                    future.attr("set_result")(toPython(*message));
+                    return future;
+                }
+                int fd = self.fileno();
+                loop.attr("add_reader")(fd, py::cpp_function([self_obj, future, loop, fd]() {
+                    // cancelled or timed out, and the done callback has not run yet: leave the message in the queue
+                    if (future.attr("done")().cast<bool>()) {
+                        loop.attr("remove_reader")(fd);
+                        return;
+                    }
+                    std::optional<ReceivedMessage> message;
+                    {
+                        py::gil_scoped_release release;
+                        message = self_obj.cast<MessageQueue &>().next();
+                    }
+                    if (message) {
+                        future.attr("set_result")(toPython(*message));
+                    }
+                }));
+                future.attr("add_done_callback")(py::cpp_function([loop, fd](const py::object &) {
+                    loop.attr("remove_reader")(fd);
+                }));
+                return future;
+            });
+
+    py::class_<CallbackExecutor, std::shared_ptr<CallbackExecutor>>(m, "CallbackExecutor")
+            .def(py::init<std::size_t, std::size_t>(), py::arg("threads") = 1, py::arg("max_pending") = 10000)
+            .def_property_readonly("threads", &CallbackExecutor::threads)
+            .def_property_readonly("dropped", &CallbackExecutor::dropped)
+            .def("__len__", &CallbackExecutor::pending, py::call_guard<py::gil_scoped_release>());
+
+    py::class_<RedundantLinkGroup>(m, "RedundantLinkGroup")
+            .def(py::init<std::vector<std::shared_ptr<Connection>>, std::size_t>(),
+                 py::arg("connections"), py::arg("window") = 64)
+            .def("add_message_callback", &RedundantLinkGroup::addMessageCallback,
+                 py::call_guard<py::gil_scoped_release>())
+            .def("remove_message_callback", &RedundantLinkGroup::removeMessageCallback,
+                 py::call_guard<py::gil_scoped_release>())
+            .def("stats", [](RedundantLinkGroup &self) {
+                auto stats = [&self] {
+                    py::gil_scoped_release release;
+                    return self.stats();
+                }();
+                py::list links;
+                for (const auto &link : stats) {
+                    links.append(py::dict(py::arg("received") = link.received,
+                                          py::arg("first") = link.first,
+                                          py::arg("duplicates") = link.duplicates,
+                                          py::arg("mean_delay_ns") = link.duplicates > 0 ?
+                                                  link.delay_ns / link.duplicates : 0));
+                }
+                return links;
             })
-            .def("__len__", &MessageQueue::size, py::call_guard<py::gil_scoped_release>());
+            .def_property_readonly("fastest", [](RedundantLinkGroup &self) -> py::object {
+                auto stats = [&self] {
+                    py::gil_scoped_release release;
+                    return self.stats();
+                }();
+                auto it = std::max_element(stats.begin(), stats.end(), [](const auto &a, const auto &b) {
+                    return a.first < b.first;
+                });
+                if (it == stats.end() || it->first == 0) {
+                    return py::none();
+                }
+                return py::int_(it - stats.begin());
+            });
+
+    py::class_<ConnectionState, std::shared_ptr<ConnectionState>>(m, "_ConnectionState");
 
-    py::class_<Connection, std::shared_ptr<Connection>>(m, "Connection")
+    py::class_<Connection, std::shared_ptr<Connection>>(m, "Connection", py::dynamic_attr())
             .def("alive", &Connection::alive)
             .def("partner", &Connection::partner)
-            .def("send", &Connection::send, py::call_guard<py::gil_scoped_release>())
+            .def("send", [](const py::object &self, Message &message) {
+                     auto &connection = self.cast<Connection &>();
+                     auto state = cachedState(self);
+                     py::gil_scoped_release release;
+                     connection.send(message);
+                     state->stats.recordSent(message);
+                 })
+            .def("send_many", [](const py::object &self, const std::vector<Message *> &messages) {
+                     // None converts to a null pointer
+                     if (std::find(messages.begin(), messages.end(), nullptr) != messages.end()) {
+                         throw py::type_error("send_many: messages must not contain None");
+                     }
+                     auto &connection = self.cast<Connection &>();
+                     auto state = cachedState(self);
+                     py::gil_scoped_release release;
+                     for (auto message : messages) {
+                         connection.send(*message);
+                         state->stats.recordSent(*message);
+                     }
+                 }, py::arg("messages"))
             .def("add_message_callback",
-                 (&Connection::addMessageCallback<std::function<void(const Message &)>>),
-                 py::call_guard<py::gil_scoped_release>())
+                 [](const std::shared_ptr<Connection> &self, std::function<void(py::object)> callback) {
+                     return self->addMessageCallback(stamped(timedCallback<ReceivedMessage>(self, std::move(callback))));
+                 }, py::call_guard<py::gil_scoped_release>())
             .def("add_message_callback",
-                 (&Connection::addMessageCallback<std::function<void(const Message &)>,
-                         std::function<void(const std::exception_ptr &)>>),
-                 py::call_guard<py::gil_scoped_release>())
+                 [](const std::shared_ptr<Connection> &self, std::function<void(py::object)> callback,
+                    std::function<void(const std::exception_ptr &)> error_callback) {
+                     return self->addMessageCallback(stamped(timedCallback<ReceivedMessage>(self, std::move(callback))),
+                                                     error_callback);
+                 }, py::call_guard<py::gil_scoped_release>())
+            .def("add_message_callback",
+                 [](const std::shared_ptr<Connection> &self, std::function<void(py::object)> callback,
+                    double max_rate_hz, const std::string &keep) {
+                     auto limiter = std::make_shared<RateLimiter>(
+                             timedCallback<ReceivedMessage>(self, std::move(callback)), max_rate_hz, keep);
+                     return self->addMessageCallback(stamped([limiter](const ReceivedMessage &message) {
+                         limiter->offer(message);
+                     }));
+                 }, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("callback"), py::arg("max_rate_hz"), py::arg("keep") = "latest")
+            .def("add_message_callback",
+                 [](const std::shared_ptr<Connection> &self, std::function<void(py::object)> callback,
+                    const std::shared_ptr<CallbackExecutor> &executor, const std::string &ordering) {
+                     if (ordering != "connection" && ordering != "message_id") {
+                         throw std::invalid_argument("ordering must be 'connection' or 'message_id'");
+                     }
+                     const bool by_message_id = ordering == "message_id";
+                     const auto connection_key = static_cast<std::size_t>(connectionState(self)->id);
+                     auto timed = std::make_shared<std::function<void(const ReceivedMessage &)>>(
+                             timedCallback<ReceivedMessage>(self, std::move(callback)));
+                     return self->addMessageCallback(stamped(
+                             [executor, timed, by_message_id, connection_key](const ReceivedMessage &message) {
+                         const std::size_t key = by_message_id ?
+                                 connection_key + static_cast<std::size_t>(message.message.id()) : connection_key;
+                         executor->submit(key, [timed, message] {
+                             (*timed)(message);
+                         });
+                     }));
+                 }, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("callback"), py::arg("executor"), py::arg("ordering") = "connection")
+            .def("add_batch_callback",
+                 [](const std::shared_ptr<Connection> &self, std::function<void(py::object)> callback,
+                    std::size_t max_batch, int max_latency_ms) {
+                     auto batch = std::make_shared<BatchCallback>(
+                             timedCallback<std::vector<ReceivedMessage>>(self, std::move(callback)),
+                             max_batch, max_latency_ms);
+                     return self->addMessageCallback(stamped([batch](const ReceivedMessage &message) {
+                         batch->push(message);
+                     }));
+                 }, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("callback"), py::arg("max_batch") = 64, py::arg("max_latency_ms") = 10)
+            .def("stats", [](const std::shared_ptr<Connection> &self) {
+                     TrafficStats::Snapshot snapshot;
+                     std::map<uint16_t, SequenceTracker::Sender> senders;
+                     {
+                         py::gil_scoped_release release;
+                         auto state = connectionState(self);
+                         snapshot = state->stats.snapshot();
+                         senders = state->sequence.snapshot();
+                     }
+                     auto direction = [](const TrafficStats::DirectionSnapshot &direction) {
+                         py::dict by_id;
+                         for (const auto &[id, counters] : direction.by_id) {
+                             by_id[py::int_(id)] = py::dict(py::arg("messages") = counters.messages,
+                                                            py::arg("bytes") = counters.bytes);
+                         }
+                         return py::dict(py::arg("messages") = direction.total.messages,
+                                         py::arg("bytes") = direction.total.bytes,
+                                         py::arg("by_id") = by_id);
+                     };
+                     py::dict d;
+                     d["rx"] = direction(snapshot.rx);
+                     d["tx"] = direction(snapshot.tx);
+                     d["callbacks"] = py::dict(py::arg("calls") = snapshot.callback_calls,
+                                               py::arg("total_ns") = snapshot.callback_ns,
+                                               py::arg("max_ns") = snapshot.callback_max_ns);
+                     d["queue_high_water"] = snapshot.queue_high_water;
+                     py::dict sender_stats;
+                     for (const auto &[key, sender] : senders) {
+                         const uint64_t expected = sender.received - sender.duplicates + sender.lost;
+                         sender_stats[py::make_tuple(key >> 8, key & 0xFF)] = py::dict(
+                                 py::arg("received") = sender.received,
+                                 py::arg("lost") = sender.lost,
+                                 py::arg("duplicates") = sender.duplicates,
+                                 py::arg("reordered") = sender.reordered,
+                                 py::arg("resets") = sender.resets,
+                                 py::arg("loss_rate") = expected > 0 ?
+                                         static_cast<double>(sender.lost) / static_cast<double>(expected) : 0.0);
+                     }
+                     d["senders"] = sender_stats;
+                     return d;
+                 })
+            .def("latency", [](const std::shared_ptr<Connection> &self) {
+                     LatencyHistogram::Snapshot queue;
+                     LatencyHistogram::Snapshot dispatch;
+                     {
+                         py::gil_scoped_release release;
+                         auto state = connectionState(self);
+                         queue = state->queue_latency.snapshot();
+                         dispatch = state->dispatch_latency.snapshot();
+                     }
+                     auto histogram = [](const LatencyHistogram::Snapshot &snapshot) {
+                         py::list buckets;
+                         for (const auto &[lower_bound_ns, count] : snapshot.buckets) {
+                             buckets.append(py::make_tuple(lower_bound_ns, count));
+                         }
+                         return py::dict(py::arg("count") = snapshot.count,
+                                         py::arg("mean_ns") = snapshot.count > 0 ?
+                                                 snapshot.total_ns / snapshot.count : 0,
+                                         py::arg("max_ns") = snapshot.max_ns,
+                                         py::arg("p50_ns") = snapshot.percentile(0.5),
+                                         py::arg("p90_ns") = snapshot.percentile(0.9),
+                                         py::arg("p99_ns") = snapshot.percentile(0.99),
+                                         py::arg("p999_ns") = snapshot.percentile(0.999),
+                                         py::arg("buckets") = buckets);
+                     };
+                     return py::dict(py::arg("queue") = histogram(queue),
+                                     py::arg("dispatch") = histogram(dispatch));
+                 })
             .def("remove_message_callback", &Connection::removeMessageCallback,
                  py::call_guard<py::gil_scoped_release>())
             .def("expect",
-                 [](Connection &self, int message_id, int source_id, int component_id) {
+                 [](const std::shared_ptr<Connection> &self, int message_id, int source_id, int component_id,
+                    const std::optional<py::dict> &where) {
+                     auto predicates = fieldPredicates(where, prototype(self, message_id));
                      py::gil_scoped_release release;
-                     return _ExpectationWrapper{self.expect(message_id, source_id, component_id)};
+                     return makeExpectation(*self, [message_id, source_id, component_id, predicates]
+                             (const Message &message) {
+                         return message.id() == message_id && matchesSender(message, source_id, component_id) &&
+                                matchesFields(message, predicates);
+                     });
                  }, py::arg("message_id"), py::arg("source_id") = mav::ANY_ID,
-                 py::arg("component_id") = mav::ANY_ID)
-            .def("expect", [](Connection &self, const std::string &message_name, int source_id, int component_id) {
+                 py::arg("component_id") = mav::ANY_ID, py::arg("where") = py::none())
+            .def("expect", [](const std::shared_ptr<Connection> &self, const std::string &message_name,
+                              int source_id, int component_id, const std::optional<py::dict> &where) {
+                     auto predicates = fieldPredicates(where, prototype(self, message_name));
                      py::gil_scoped_release release;
-                     return _ExpectationWrapper{self.expect(message_name, source_id, component_id)};
+                     return makeExpectation(*self, [message_name, source_id, component_id, predicates]
+                             (const Message &message) {
+                         return message.name() == message_name && matchesSender(message, source_id, component_id) &&
+                                matchesFields(message, predicates);
+                     });
                  }, py::arg("message_name"), py::arg("source_id") = mav::ANY_ID,
+                 py::arg("component_id") = mav::ANY_ID, py::arg("where") = py::none())
+            .def("expect_async",
+                 [](const std::shared_ptr<Connection> &self, int message_id, int source_id, int component_id,
+                    const std::optional<py::dict> &where) {
+                     auto predicates = fieldPredicates(where, prototype(self, message_id));
+                     return expectAsync(self, [message_id, source_id, component_id, predicates](const Message &message) {
+                         return message.id() == message_id && matchesSender(message, source_id, component_id) &&
+                                matchesFields(message, predicates);
+                     });
+                 }, py::arg("message_id"), py::arg("source_id") = mav::ANY_ID,
+                 py::arg("component_id") = mav::ANY_ID, py::arg("where") = py::none())
+            .def("expect_async",
+                 [](const std::shared_ptr<Connection> &self, const std::string &message_name,
+                    int source_id, int component_id, const std::optional<py::dict> &where) {
+                     auto predicates = fieldPredicates(where, prototype(self, message_name));
+                     return expectAsync(self, [message_name, source_id, component_id, predicates](const Message &message) {
+                         return message.name() == message_name && matchesSender(message, source_id, component_id) &&
+                                matchesFields(message, predicates);
+                     });
+                 }, py::arg("message_name"), py::arg("source_id") = mav::ANY_ID,
+                 py::arg("component_id") = mav::ANY_ID, py::arg("where") = py::none())
+            .def("latest",
+                 [](const py::object &self, const std::string &message_name, int source_id, int component_id) {
+                     auto state = cachedState(self);
+                     py::gil_scoped_release release;
+                     return state->latest.latest(message_name, source_id, component_id);
+                 },
+                 py::arg("message_name"), py::arg("source_id") = mav::ANY_ID,
+                 py::arg("component_id") = mav::ANY_ID)
+            .def("latest",
+                 [](const py::object &self, int message_id, int source_id, int component_id) {
+                     auto state = cachedState(self);
+                     py::gil_scoped_release release;
+                     return state->latest.latest(message_id, source_id, component_id);
+                 },
+                 py::arg("message_id"), py::arg("source_id") = mav::ANY_ID,
                  py::arg("component_id") = mav::ANY_ID)
             .def("receive",
                  [](Connection &self, const _ExpectationWrapper &expectation, int timeout_ms) {
                      py::gil_scoped_release release;
                      return self.receive(expectation.expectation, timeout_ms);
                  }, py::arg("expectation"), py::arg("timeout_ms") = -1)
+            .def("command", &runCommand, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("message"), py::arg("retries") = 3, py::arg("timeout_ms") = 1000)
+            .def("receive_any",
+                 [](Connection &, const std::vector<_ExpectationWrapper> &expectations, int timeout_ms) {
+                     if (expectations.empty()) {
+                         throw std::invalid_argument("receive_any needs at least one expectation");
+                     }
+                     py::gil_scoped_release release;
+                     auto waiter = std::make_shared<ExpectationWaiter>();
+                     auto attach = [&expectations](const std::shared_ptr<ExpectationWaiter> &attached) {
+                         for (const auto &expectation : expectations) {
+                             std::lock_guard lg{expectation.result->lock};
+                             expectation.result->waiter = attached;
+                         }
+                     };
+                     int index = -1;
+                     std::optional<Message> message;
+                     auto any_matched = [&expectations, &index, &message]() {
+                         for (std::size_t i = 0; i < expectations.size(); i++) {
+                             std::lock_guard lg{expectations[i].result->lock};
+                             if (expectations[i].result->message) {
+                                 index = static_cast<int>(i);
+                                 message = expectations[i].result->message;
+                                 return true;
+                             }
+                         }
+                         return false;
+                     };
+                     attach(waiter);
+                     bool matched;
+                     {
+                         std::unique_lock lk{waiter->lock};
+                         if (timeout_ms < 0) {
+                             waiter->cv.wait(lk, any_matched);
+                             matched = true;
+                         } else {
+                             matched = waiter->cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), any_matched);
+                         }
+                     }
+                     attach(nullptr);
+                     if (!matched) {
+                         throw TimeoutException("Expected message timed out");
+                     }
+                     return std::make_pair(index, *message);
+                 }, py::arg("expectations"), py::arg("timeout_ms") = -1)
             .def("receive",
                  py::overload_cast<const std::string &, int, int, int>(&Connection::receive),
                  py::call_guard<py::gil_scoped_release>(),
@@ -0,0 +1,216 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/Network.h"
+#include "DatagramInterface.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Sends messages periodically from arbitrary identities, from a single thread.
+// Emissions are kept in a hashed timer wheel, so a tick only touches the emissions due in its slot,
+// no matter how many components are emulated. Each emission may go out on its own interface,
+// so one scheduler can stream the heartbeats of many links.
+// Frames are written to the interfaces directly, so they must be UDP interfaces, and the scheduled identities
+// must differ from those of runtimes on the same links, whose sequence numbers are counted separately.
+class EmissionScheduler {
+private:
+    static constexpr std::size_t WHEEL_SIZE = 512;
+
+    struct Emission {
+        Message message;
+        NetworkInterface &interface;
+        const Identifier sender;
+        const ConnectionPartner partner;
+        const uint64_t period_ticks;
+        // full turns of the wheel left before it is due
+        uint64_t rounds = 0;
+        std::atomic<bool> removed{false};
+
+        Emission(Message message, NetworkInterface &interface, Identifier sender, ConnectionPartner partner,
+                 uint64_t period_ticks) :
+                message(std::move(message)), interface(interface), sender(sender), partner(partner),
+                period_ticks(period_ticks) {}
+    };
+
+    NetworkInterface &_interface;
+    const std::chrono::microseconds _tick;
+    std::mutex _lock;
+    std::condition_variable _cv;
+    std::array<std::vector<std::shared_ptr<Emission>>, WHEEL_SIZE> _wheel;
+    std::unordered_map<uint64_t, std::shared_ptr<Emission>> _emissions;
+    uint64_t _next_handle = 0;
+    uint64_t _current_tick = 0;
+    // per (system id << 8 | component id), only touched by the scheduler thread
+    std::unordered_map<uint16_t, uint8_t> _sequences;
+    std::atomic<uint64_t> _sent{0};
+    std::atomic<uint64_t> _errors{0};
+    bool _stop = false;
+    std::thread _thread;
+
+    void _insert(const std::shared_ptr<Emission> &emission, uint64_t delay_ticks) {
+        delay_ticks = std::max<uint64_t>(delay_ticks, 1);
+        emission->rounds = (delay_ticks - 1) / WHEEL_SIZE;
+        _wheel[(_current_tick + delay_ticks) % WHEEL_SIZE].push_back(emission);
+    }
+
+    void _emit(Emission &emission) {
+        const auto key = static_cast<uint16_t>((emission.sender.system_id << 8) | emission.sender.component_id);
+        const uint32_t size = emission.message.finalize(_sequences[key]++, emission.sender);
+        try {
+            emission.interface.send(emission.message.data(), size, emission.partner);
+            _sent.fetch_add(1, std::memory_order_relaxed);
+        } catch (const NetworkError &) {
+            _errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void _run() {
+        std::vector<std::shared_ptr<Emission>> due;
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock lk{_lock};
+        while (!_stop) {
+            // ticks are counted from the start, so that late wakeups do not add up to drift
+            if (_cv.wait_until(lk, start + _tick * (_current_tick + 1), [this] { return _stop; })) {
+                return;
+            }
+            _current_tick++;
+            auto &slot = _wheel[_current_tick % WHEEL_SIZE];
+            for (auto it = slot.begin(); it != slot.end();) {
+                auto &emission = *it;
+                if (emission->removed) {
+                    it = slot.erase(it);
+                } else if (emission->rounds > 0) {
+                    emission->rounds--;
+                    ++it;
+                } else {
+                    due.push_back(std::move(emission));
+                    it = slot.erase(it);
+                }
+            }
+            for (const auto &emission : due) {
+                _insert(emission, emission->period_ticks);
+            }
+            lk.unlock();
+            for (const auto &emission : due) {
+                _emit(*emission);
+            }
+            due.clear();
+            lk.lock();
+        }
+    }
+
+public:
+    EmissionScheduler(NetworkInterface &interface, int tick_us) :
+            _interface(interface), _tick(tick_us) {
+        if (tick_us <= 0) {
+            throw std::invalid_argument("tick_us must be positive");
+        }
+        requireDatagramInterface(interface, "EmissionScheduler");
+        _thread = std::thread{&EmissionScheduler::_run, this};
+    }
+
+    ~EmissionScheduler() {
+        {
+            std::lock_guard lg{_lock};
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    uint64_t add(const Message &message, double rate_hz, const Identifier &sender, const ConnectionPartner &partner,
+                 NetworkInterface *interface) {
+        if (!(rate_hz > 0)) {
+            throw std::invalid_argument("rate_hz must be positive");
+        }
+        if (interface) {
+            requireDatagramInterface(*interface, "EmissionScheduler");
+        }
+        const auto period = std::chrono::duration<double>(1.0 / rate_hz);
+        const auto period_ticks = std::max<uint64_t>(1, static_cast<uint64_t>(period / _tick + 0.5));
+        auto emission = std::make_shared<Emission>(message, interface ? *interface : _interface,
+                                                   sender, partner, period_ticks);
+        std::lock_guard lg{_lock};
+        // spreads emissions over the wheel, so that equal rates do not all fire in the same tick
+        _insert(emission, 1 + _next_handle % period_ticks);
+        _emissions.emplace(_next_handle, std::move(emission));
+        return _next_handle++;
+    }
+
+    void remove(uint64_t handle) {
+        std::lock_guard lg{_lock};
+        auto it = _emissions.find(handle);
+        if (it != _emissions.end()) {
+            it->second->removed = true;
+            _emissions.erase(it);
+        }
+    }
+
+    std::size_t size() {
+        std::lock_guard lg{_lock};
+        return _emissions.size();
+    }
+
+    std::map<std::string, uint64_t> stats() {
+        return {{"sent", _sent.load(std::memory_order_relaxed)},
+                {"errors", _errors.load(std::memory_order_relaxed)}};
+    }
+};
+
+
+void bind_EmissionScheduler(py::module m) {
+    py::class_<EmissionScheduler>(m, "EmissionScheduler")
+            .def(py::init<NetworkInterface &, int>(), py::keep_alive<1, 2>(),
+                 py::arg("interface"), py::arg("tick_us") = 10000)
+            .def("add", &EmissionScheduler::add, py::call_guard<py::gil_scoped_release>(), py::keep_alive<1, 6>(),
+                 py::arg("message"), py::arg("rate_hz"), py::arg("sender"), py::arg("partner") = ConnectionPartner(),
+                 py::arg("interface") = nullptr)
+            .def("remove", &EmissionScheduler::remove, py::call_guard<py::gil_scoped_release>())
+            .def("__len__", &EmissionScheduler::size, py::call_guard<py::gil_scoped_release>())
+            .def("stats", &EmissionScheduler::stats);
+}
@@ -0,0 +1,267 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include "MessageInbox.h"
+#include "ByteRanges.h"
+#include "ProtocolClient.h"
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Reads files with the MAVLink FTP protocol. Burst reads stream the file in one request;
+// offsets lost on the way are read again one chunk at a time.
+class FtpClient : public ProtocolClient {
+private:
+    enum Opcode : uint8_t {
+        TERMINATE_SESSION = 1,
+        OPEN_FILE_RO = 4,
+        READ_FILE = 5,
+        BURST_READ_FILE = 15,
+        ACK = 128,
+        NAK = 129
+    };
+    static constexpr uint8_t ERROR_EOF = 6;
+    static constexpr std::size_t HEADER_SIZE = 12;
+    static constexpr std::size_t MAX_DATA_SIZE = 239;
+
+    // the FTP header inside the payload of FILE_TRANSFER_PROTOCOL
+    struct Packet {
+        std::vector<uint8_t> payload;
+
+        uint8_t session() const { return payload[2]; }
+        uint8_t opcode() const { return payload[3]; }
+        uint8_t size() const { return std::min<uint8_t>(payload[4], MAX_DATA_SIZE); }
+        uint8_t requestOpcode() const { return payload[5]; }
+        bool burstComplete() const { return payload[6] != 0; }
+        uint32_t offset() const {
+            return payload[8] | (payload[9] << 8) | (payload[10] << 16) | (static_cast<uint32_t>(payload[11]) << 24);
+        }
+        const uint8_t *data() const { return payload.data() + HEADER_SIZE; }
+    };
+
+    uint16_t _seq = 0;
+
+    void _sendPacket(uint8_t opcode, uint8_t session, uint32_t offset, uint32_t size, const std::string &data = {}) {
+        std::vector<uint8_t> payload(HEADER_SIZE + MAX_DATA_SIZE, 0);
+        payload[0] = static_cast<uint8_t>(_seq & 0xFF);
+        payload[1] = static_cast<uint8_t>(_seq >> 8);
+        _seq++;
+        payload[2] = session;
+        payload[3] = opcode;
+        payload[4] = static_cast<uint8_t>(data.empty() ? size : data.size());
+        for (int i = 0; i < 4; i++) {
+            payload[8 + i] = static_cast<uint8_t>(offset >> (8 * i));
+        }
+        std::memcpy(payload.data() + HEADER_SIZE, data.data(), std::min(data.size(), MAX_DATA_SIZE));
+        auto message = _create("FILE_TRANSFER_PROTOCOL");
+        message.set("target_network", static_cast<uint8_t>(0));
+        message.set("payload", payload);
+        _send(message);
+    }
+
+    // next reply to a request, or nothing once the deadline passes
+    static std::optional<Packet> _reply(MessageInbox &inbox, uint8_t request_opcode, int session,
+                                        std::chrono::steady_clock::time_point deadline) {
+        while (auto message = inbox.next(deadline)) {
+            Packet packet{message->get<std::vector<uint8_t>>("payload")};
+            if (packet.payload.size() < HEADER_SIZE || packet.requestOpcode() != request_opcode ||
+                (packet.opcode() != ACK && packet.opcode() != NAK) ||
+                (session >= 0 && packet.session() != session)) {
+                continue;
+            }
+            return packet;
+        }
+        return std::nullopt;
+    }
+
+    // sends a request until it is answered, at most 1 + retries times
+    Packet _exchange(MessageInbox &inbox, uint8_t opcode, int session, uint32_t offset, uint32_t size,
+                     const std::string &data, int timeout_ms, int retries) {
+        for (int attempt = 0; attempt <= retries; attempt++) {
+            _sendPacket(opcode, static_cast<uint8_t>(std::max(session, 0)), offset, size, data);
+            auto reply = _reply(inbox, opcode, session,
+                                std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms));
+            if (reply) {
+                return *reply;
+            }
+        }
+        throw TimeoutException("No reply to FTP opcode " + std::to_string(opcode));
+    }
+
+    static void _throwNak(const Packet &packet, const std::string &what) {
+        throw std::runtime_error("FTP " + what + " failed with error " + std::to_string(packet.data()[0]));
+    }
+
+public:
+    using Sink = std::function<void(uint32_t offset, const uint8_t *data, uint32_t size)>;
+
+    using ProtocolClient::ProtocolClient;
+
+    // Reads a file into the sink returned by prepare, which is called with the file size once it is known
+    uint32_t read(const std::string &path, const std::function<Sink(uint32_t)> &prepare, int timeout_ms, int retries) {
+        if (path.size() > MAX_DATA_SIZE) {
+            throw std::invalid_argument("FTP path is too long");
+        }
+        MessageInbox inbox(_connection, [this](const Message &message) {
+            return message.name() == "FILE_TRANSFER_PROTOCOL" && _fromTarget(message);
+        });
+
+        auto opened = _exchange(inbox, OPEN_FILE_RO, -1, 0, 0, path, timeout_ms, retries);
+        if (opened.opcode() == NAK) {
+            _throwNak(opened, "open of " + path);
+        }
+        const uint8_t session = opened.session();
+        const uint32_t file_size = opened.data()[0] | (opened.data()[1] << 8) | (opened.data()[2] << 16) |
+                                   (static_cast<uint32_t>(opened.data()[3]) << 24);
+        ScopeExit terminate{[this, session] {
+            try {
+                _sendPacket(TERMINATE_SESSION, session, 0, 0);
+            } catch (const std::exception &) {
+                // the vehicle closes stale sessions itself
+            }
+        }};
+
+        const Sink sink = prepare(file_size);
+        ByteRanges received;
+        auto store = [&](const Packet &packet) {
+            const uint32_t offset = packet.offset();
+            if (offset >= file_size) {
+                return;
+            }
+            const uint32_t size = std::min<uint32_t>(packet.size(), file_size - offset);
+            sink(offset, packet.data(), size);
+            received.mark(offset, offset + size);
+        };
+
+        int stalled = 0;
+        while (true) {
+            auto [gap_start, gap_end] = received.firstGap();
+            if (gap_start < gap_end) {
+                // refill what the burst lost
+                auto chunk = _exchange(inbox, READ_FILE, session, gap_start,
+                                       std::min<uint32_t>(gap_end - gap_start, MAX_DATA_SIZE), {}, timeout_ms, retries);
+                if (chunk.opcode() == NAK) {
+                    _throwNak(chunk, "read of " + path);
+                }
+                store(chunk);
+                // an answer that fills nothing, such as an empty chunk, does not count as progress either
+                if (received.firstGap().first != gap_start) {
+                    stalled = 0;
+                } else if (++stalled > retries) {
+                    throw TimeoutException("FTP read of " + path + " stalled at offset " + std::to_string(gap_start));
+                }
+                continue;
+            }
+            if (received.end() >= file_size) {
+                return file_size;
+            }
+            // stream the rest of the file
+            const uint32_t before = received.end();
+            _sendPacket(BURST_READ_FILE, session, before, MAX_DATA_SIZE);
+            while (auto packet = _reply(inbox, BURST_READ_FILE, session,
+                                        std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms))) {
+                if (packet->opcode() == NAK) {
+                    if (packet->data()[0] != ERROR_EOF) {
+                        _throwNak(*packet, "burst read of " + path);
+                    }
+                    break;
+                }
+                store(*packet);
+                if (packet->burstComplete()) {
+                    break;
+                }
+            }
+            if (received.end() > before) {
+                stalled = 0;
+            } else if (++stalled > retries) {
+                throw TimeoutException("FTP burst read of " + path + " stalled");
+            }
+        }
+    }
+};
+
+
+void bind_FtpClient(py::module m) {
+    bindProtocolClient(py::class_<FtpClient>(m, "FtpClient"))
+            .def("read", [](FtpClient &self, const std::string &path, int timeout_ms, int retries) {
+                     std::string contents;
+                     {
+                         py::gil_scoped_release release;
+                         self.read(path, [&contents](uint32_t size) -> FtpClient::Sink {
+                             contents.resize(size);
+                             return [&contents](uint32_t offset, const uint8_t *data, uint32_t size) {
+                                 std::memcpy(contents.data() + offset, data, size);
+                             };
+                         }, timeout_ms, retries);
+                     }
+                     return py::bytes(contents);
+                 }, py::arg("path"), py::arg("timeout_ms") = 1000, py::arg("retries") = 5)
+            .def("read_into", [](FtpClient &self, const std::string &path, const py::buffer &buffer,
+                                 int timeout_ms, int retries) {
+                     py::buffer_info info = buffer.request(true);
+                     if (info.ndim != 1 || info.itemsize != 1 || info.strides[0] != 1) {
+                         throw std::invalid_argument("read_into needs a contiguous byte buffer");
+                     }
+                     auto target = static_cast<uint8_t *>(info.ptr);
+                     const auto capacity = static_cast<std::size_t>(info.size);
+                     py::gil_scoped_release release;
+                     return self.read(path, [target, capacity](uint32_t size) -> FtpClient::Sink {
+                         if (size > capacity) {
+                             throw std::invalid_argument("Buffer is smaller than the file");
+                         }
+                         return [target](uint32_t offset, const uint8_t *data, uint32_t size) {
+                             std::memcpy(target + offset, data, size);
+                         };
+                     }, timeout_ms, retries);
+                 }, py::arg("path"), py::arg("buffer"), py::arg("timeout_ms") = 1000, py::arg("retries") = 5)
+            .def("read_to_fd", [](FtpClient &self, const std::string &path, int fd, int timeout_ms, int retries) {
+                     requireSeekable(fd);
+                     return self.read(path, [fd](uint32_t) -> FtpClient::Sink {
+                         return [fd](uint32_t offset, const uint8_t *data, uint32_t size) {
+                             writeAt(fd, data, size, static_cast<off_t>(offset));
+                         };
+                     }, timeout_ms, retries);
+                 }, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("path"), py::arg("fd"), py::arg("timeout_ms") = 1000, py::arg("retries") = 5);
+}
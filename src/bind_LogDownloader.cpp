@@ -0,0 +1,206 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include "MessageInbox.h"
+#include "ByteRanges.h"
+#include "ProtocolClient.h"
+#include <map>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Downloads onboard logs with LOG_REQUEST_DATA. LOG_DATA chunks are written to the output file
+// at their offset as they arrive; once the stream goes quiet, holes are requested again as ranges.
+class LogDownloader : public ProtocolClient {
+public:
+    struct Entry {
+        int id;
+        uint32_t time_utc;
+        uint32_t size;
+    };
+
+private:
+    static constexpr uint32_t MAX_CHUNK_SIZE = 90;
+
+    void _requestEntries(int first, int last) {
+        auto request = _create("LOG_REQUEST_LIST");
+        request.set("start", static_cast<uint16_t>(first));
+        request.set("end", static_cast<uint16_t>(last));
+        _send(request);
+    }
+
+    void _requestData(int log_id, uint32_t offset, uint32_t count) {
+        auto request = _create("LOG_REQUEST_DATA");
+        request.set("id", static_cast<uint16_t>(log_id));
+        request.set("ofs", offset);
+        request.set("count", count);
+        _send(request);
+    }
+
+public:
+    using ProtocolClient::ProtocolClient;
+
+    // Lists the logs with ids from first to last, waiting until timeout_ms pass without a new entry
+    std::vector<Entry> entries(int first, int last, int timeout_ms, int retries) {
+        MessageInbox inbox(_connection, [this](const Message &message) {
+            return message.name() == "LOG_ENTRY" && _fromTarget(message);
+        });
+        std::map<int, Entry> entries;
+        int expected = -1;
+        for (int attempt = 0; attempt <= retries && entries.empty(); attempt++) {
+            _requestEntries(first, last);
+            while (auto entry = inbox.next(timeout_ms)) {
+                expected = entry->get<uint16_t>("num_logs");
+                const int id = entry->get<uint16_t>("id");
+                // a vehicle without logs answers with a single entry of id 0
+                if (expected > 0 && id >= first && id <= last) {
+                    entries[id] = Entry{id, entry->get<uint32_t>("time_utc"), entry->get<uint32_t>("size")};
+                }
+                if (expected == 0 || static_cast<int>(entries.size()) >= std::min(expected, last - first + 1)) {
+                    break;
+                }
+            }
+            if (expected >= 0) {
+                break;
+            }
+        }
+        if (expected < 0) {
+            throw TimeoutException("No LOG_ENTRY received");
+        }
+        std::vector<Entry> result;
+        for (const auto &[id, entry] : entries) {
+            result.push_back(entry);
+        }
+        return result;
+    }
+
+    // Downloads a log into fd and returns its size
+    uint32_t download(int log_id, int fd, int timeout_ms, int retries) {
+        requireSeekable(fd);
+        auto found = entries(log_id, log_id, timeout_ms, retries);
+        if (found.empty()) {
+            throw std::invalid_argument("No log with id " + std::to_string(log_id));
+        }
+        const uint32_t size = found.front().size;
+        // regular files are allocated up front, block devices already have their size
+        struct stat info {};
+        if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("Could not resize file descriptor");
+        }
+
+        MessageInbox inbox(_connection, [this, log_id](const Message &message) {
+            return message.name() == "LOG_DATA" && _fromTarget(message) && message.get<uint16_t>("id") == log_id;
+        });
+        ByteRanges received;
+        int stalled = 0;
+        while (true) {
+            auto [gap_start, gap_end] = received.firstGap();
+            if (gap_start == gap_end) {
+                if (received.end() >= size) {
+                    break;
+                }
+                gap_start = received.end();
+                gap_end = size;
+            }
+            const uint32_t before = received.end();
+            const auto gap_before = gap_start;
+            _requestData(log_id, gap_start, gap_end - gap_start);
+            while (auto data = inbox.next(timeout_ms)) {
+                const uint32_t offset = data->get<uint32_t>("ofs");
+                const uint32_t count = std::min<uint32_t>(data->get<uint8_t>("count"), MAX_CHUNK_SIZE);
+                if (count == 0 || offset >= size) {
+                    continue;
+                }
+                const uint32_t length = std::min(count, size - offset);
+                const auto bytes = data->get<std::vector<uint8_t>>("data");
+                writeAt(fd, bytes.data(), length, static_cast<off_t>(offset));
+                received.mark(offset, offset + length);
+                if (offset + length >= gap_end) {
+                    break;
+                }
+            }
+            if (received.end() > before || received.firstGap().first != gap_before) {
+                stalled = 0;
+            } else if (++stalled > retries) {
+                throw TimeoutException("Log download stalled at offset " + std::to_string(gap_start));
+            }
+        }
+
+        auto end = _create("LOG_REQUEST_END");
+        _send(end);
+        return size;
+    }
+};
+
+
+void bind_LogDownloader(py::module m) {
+    bindProtocolClient(py::class_<LogDownloader>(m, "LogDownloader"))
+            .def("entries", [](LogDownloader &self, int first, int last, int timeout_ms, int retries) {
+                     std::vector<LogDownloader::Entry> entries;
+                     {
+                         py::gil_scoped_release release;
+                         entries = self.entries(first, last, timeout_ms, retries);
+                     }
+                     py::list result;
+                     for (const auto &entry : entries) {
+                         result.append(py::dict(py::arg("id") = entry.id,
+                                                py::arg("time_utc") = entry.time_utc,
+                                                py::arg("size") = entry.size));
+                     }
+                     return result;
+                 }, py::arg("first") = 0, py::arg("last") = 0xFFFF,
+                 py::arg("timeout_ms") = 1000, py::arg("retries") = 3)
+            .def("download_to_fd", &LogDownloader::download, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("log_id"), py::arg("fd"), py::arg("timeout_ms") = 1000, py::arg("retries") = 5)
+            .def("download", [](LogDownloader &self, int log_id, const std::string &path, int timeout_ms, int retries) {
+                     const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                     if (fd < 0) {
+                         throw std::runtime_error("Could not open " + path);
+                     }
+                     ScopeExit close_fd{[fd] { ::close(fd); }};
+                     return self.download(log_id, fd, timeout_ms, retries);
+                 }, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("log_id"), py::arg("path"), py::arg("timeout_ms") = 1000, py::arg("retries") = 5);
+}
@@ -66,7 +66,7 @@ py::dict toDict(const Message &m) {
 
 
 void bind_Message(py::module m) {
-    py::class_<Message>(m, "Message")
+    py::class_<Message>(m, "Message", py::dynamic_attr())
             .def_property_readonly("id", &Message::id)
             .def_property_readonly("name", &Message::name)
             .def_property_readonly("type", &Message::type)
@@ -108,5 +108,7 @@ void bind_Message(py::module m) {
             .def("__iter__", [](const Message &m) { return py::make_iterator(
                     mav::FieldIterate(m).begin(), mav::FieldIterate(m).end()); }, py::keep_alive<0, 1>())
             .def("__contains__", [](Message &m, const std::string &key) { return m.type().containsField(key);})
-            .def("__repr__", &Message::toString);
+            .def("__repr__", &Message::toString)
+            // set on messages handed out by MessageQueue and message callbacks
+            .attr("receive_time_ns") = py::none();
 }
@@ -0,0 +1,219 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/functional.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include "MessageInbox.h"
+#include "ProtocolClient.h"
+#include <map>
+#include <stdexcept>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Uploads and downloads missions with the MAVLink mission protocol. Items are passed as columns,
+// one list per MISSION_ITEM_INT field, so that large missions do not cost a python object per item.
+class MissionClient : public ProtocolClient {
+public:
+    using Columns = std::map<std::string, std::vector<NativeVariantType>>;
+    using Progress = std::function<void(int, int)>;
+
+private:
+    // set by the client, not taken from the columns
+    static bool _isProtocolField(const std::string &field) {
+        return field == "target_system" || field == "target_component" || field == "seq" || field == "mission_type";
+    }
+
+    Message _create(const std::string &name, int mission_type) const {
+        auto message = ProtocolClient::_create(name);
+        message.set("mission_type", static_cast<uint8_t>(mission_type));
+        return message;
+    }
+
+    // reports whole percents only, so that the callback does not take the GIL for every item
+    static void _report(const Progress &progress, int done, int total, int &last_percent) {
+        if (!progress) {
+            return;
+        }
+        const int percent = total > 0 ? done * 100 / total : 100;
+        if (percent != last_percent) {
+            last_percent = percent;
+            progress(done, total);
+        }
+    }
+
+    // Sends a request until a reply arrives, at most 1 + retries times
+    Message _exchange(MessageInbox &inbox, Message &request, const std::function<bool(const Message &)> &is_reply,
+                      int timeout_ms, int retries) {
+        for (int attempt = 0; attempt <= retries; attempt++) {
+            _send(request);
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+            while (auto reply = inbox.next(deadline)) {
+                if (is_reply(*reply)) {
+                    return *reply;
+                }
+            }
+        }
+        throw TimeoutException("No reply to " + request.name());
+    }
+
+public:
+    using ProtocolClient::ProtocolClient;
+
+    void upload(const std::map<std::string, std::vector<double>> &items, int mission_type,
+                const Progress &progress, int timeout_ms, int retries) {
+        // everything is checked before MISSION_COUNT, which puts the vehicle into upload state
+        const auto item = _message_set.create("MISSION_ITEM_INT");
+        std::size_t count = items.empty() ? 0 : items.begin()->second.size();
+        for (const auto &[field, column] : items) {
+            if (_isProtocolField(field)) {
+                throw std::invalid_argument("Column '" + field + "' is set by the mission client");
+            }
+            if (!item.type().containsField(field)) {
+                throw std::invalid_argument("MISSION_ITEM_INT has no field '" + field + "'");
+            }
+            if (column.size() != count) {
+                throw std::invalid_argument("All columns must have the same length");
+            }
+        }
+        if (count > 0xFFFF) {
+            throw std::invalid_argument("A mission has at most 65535 items");
+        }
+
+        MessageInbox inbox(_connection, [this](const Message &message) {
+            return _fromTarget(message) && (message.name() == "MISSION_REQUEST_INT" ||
+                                            message.name() == "MISSION_REQUEST" ||
+                                            message.name() == "MISSION_ACK");
+        });
+        auto mission_count = _create("MISSION_COUNT", mission_type);
+        mission_count.set("count", static_cast<uint16_t>(count));
+        Message last_sent = mission_count;
+        _send(last_sent);
+
+        int last_percent = -1;
+        int attempts = 0;
+        while (true) {
+            auto reply = inbox.next(timeout_ms);
+            if (!reply) {
+                if (++attempts > retries) {
+                    throw TimeoutException("Mission upload timed out");
+                }
+                _send(last_sent);
+                continue;
+            }
+            if (reply->get<uint8_t>("mission_type") != mission_type) {
+                continue;
+            }
+            attempts = 0;
+            if (reply->name() == "MISSION_ACK") {
+                const int result = reply->get<uint8_t>("type");
+                if (result != 0) {
+                    throw std::runtime_error("Mission upload rejected with MAV_MISSION_RESULT " + std::to_string(result));
+                }
+                _report(progress, static_cast<int>(count), static_cast<int>(count), last_percent);
+                return;
+            }
+            const std::size_t seq = reply->get<uint16_t>("seq");
+            if (seq >= count) {
+                continue;
+            }
+            last_sent = _create("MISSION_ITEM_INT", mission_type);
+            last_sent.set("seq", static_cast<uint16_t>(seq));
+            for (const auto &[field, column] : items) {
+                last_sent.set(field, column[seq]);
+            }
+            _send(last_sent);
+            _report(progress, static_cast<int>(seq), static_cast<int>(count), last_percent);
+        }
+    }
+
+    Columns download(int mission_type, const Progress &progress, int timeout_ms, int retries) {
+        MessageInbox inbox(_connection, [this](const Message &message) {
+            return _fromTarget(message) && (message.name() == "MISSION_COUNT" || message.name() == "MISSION_ITEM_INT");
+        });
+        auto is_for_type = [mission_type](const Message &message) {
+            return message.get<uint8_t>("mission_type") == mission_type;
+        };
+
+        auto request_list = _create("MISSION_REQUEST_LIST", mission_type);
+        const int count = _exchange(inbox, request_list, [&is_for_type](const Message &message) {
+            return message.name() == "MISSION_COUNT" && is_for_type(message);
+        }, timeout_ms, retries).get<uint16_t>("count");
+
+        Columns items;
+        for (const auto &field : _message_set.create("MISSION_ITEM_INT").type().fieldNames()) {
+            if (!_isProtocolField(field)) {
+                items[field].reserve(count);
+            }
+        }
+        int last_percent = -1;
+        for (int seq = 0; seq < count; seq++) {
+            auto request = _create("MISSION_REQUEST_INT", mission_type);
+            request.set("seq", static_cast<uint16_t>(seq));
+            auto item = _exchange(inbox, request, [&is_for_type, seq](const Message &message) {
+                return message.name() == "MISSION_ITEM_INT" && is_for_type(message) &&
+                       message.get<uint16_t>("seq") == seq;
+            }, timeout_ms, retries);
+            for (auto &[field, column] : items) {
+                column.push_back(item.getAsNativeTypeInVariant(field));
+            }
+            _report(progress, seq + 1, count, last_percent);
+        }
+
+        auto ack = _create("MISSION_ACK", mission_type);
+        ack.set("type", static_cast<uint8_t>(0));
+        _send(ack);
+        if (count == 0) {
+            _report(progress, 0, 0, last_percent);
+        }
+        return items;
+    }
+};
+
+
+void bind_MissionClient(py::module m) {
+    bindProtocolClient(py::class_<MissionClient>(m, "MissionClient"))
+            .def("upload", &MissionClient::upload, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("items"), py::arg("mission_type") = 0, py::arg("progress") = py::none(),
+                 py::arg("timeout_ms") = 1000, py::arg("retries") = 5)
+            .def("download", &MissionClient::download, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("mission_type") = 0, py::arg("progress") = py::none(),
+                 py::arg("timeout_ms") = 1000, py::arg("retries") = 5);
+}
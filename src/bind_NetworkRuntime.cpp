@@ -36,15 +36,55 @@
 #include <pybind11/functional.h>
 #include <pybind11/stl.h>
 #include "mav/Network.h"
+#include "ConnectionState.h"
+#include "LockedInterface.h"
 
 namespace py = pybind11;
 using namespace mav;
+using namespace libmav_python;
+
+// Constructed before the NetworkRuntime base, which keeps a reference to the interface
+struct RuntimeInterface {
+    std::shared_ptr<LockedInterface> locked_interface;
+
+    explicit RuntimeInterface(NetworkInterface &interface) :
+            locked_interface(std::make_shared<LockedInterface>(interface)) {}
+};
+
+// Runs on a LockedInterface, and hands it and the message set of the runtime to its connections,
+// so that they can look up message definitions and write to the link through the same send lock
+class BoundNetworkRuntime : private RuntimeInterface, public NetworkRuntime {
+public:
+    const MessageSet &message_set;
+
+    BoundNetworkRuntime(const Identifier &own_id, const MessageSet &message_set, NetworkInterface &interface) :
+            RuntimeInterface(interface), NetworkRuntime(own_id, message_set, *locked_interface),
+            message_set(message_set) {}
+
+    BoundNetworkRuntime(const MessageSet &message_set, NetworkInterface &interface) :
+            RuntimeInterface(interface), NetworkRuntime(message_set, *locked_interface), message_set(message_set) {}
+
+    BoundNetworkRuntime(const Identifier &own_id, const MessageSet &message_set, const Message &heartbeat,
+                        NetworkInterface &interface) :
+            RuntimeInterface(interface), NetworkRuntime(own_id, message_set, heartbeat, *locked_interface),
+            message_set(message_set) {}
+
+    BoundNetworkRuntime(const MessageSet &message_set, const Message &heartbeat, NetworkInterface &interface) :
+            RuntimeInterface(interface), NetworkRuntime(message_set, heartbeat, *locked_interface),
+            message_set(message_set) {}
+
+    void attach(const std::shared_ptr<Connection> &connection) const {
+        auto state = connectionState(connection);
+        state->message_set = &message_set;
+        std::atomic_store(&state->interface, locked_interface);
+    }
+};
 
 
 void bind_NetworkRuntime(py::module m) {
     py::class_<NetworkInterface>(m, "NetworkInterface");
 
-    py::class_<NetworkRuntime>(m, "NetworkRuntime")
+    py::class_<BoundNetworkRuntime>(m, "NetworkRuntime")
             .def(py::init<const Identifier&, const MessageSet&, NetworkInterface&>(), py::keep_alive<1, 4>(),
                     py::arg("own_mavlink_id"), py::arg("message_set"), py::arg("interface"))
             .def(py::init<const MessageSet&, NetworkInterface&>(), py::keep_alive<1, 3>(),
@@ -53,9 +93,21 @@ void bind_NetworkRuntime(py::module m) {
                     py::arg("own_mavlink_id"), py::arg("message_set"), py::arg("heartbeat_message"), py::arg("interface"))
             .def(py::init<const MessageSet&, const Message&, NetworkInterface&>(), py::arg("message_set"), py::keep_alive<1, 4>(),
                     py::arg("heartbeat_message"), py::arg("interface"))
-            .def("on_connection", &NetworkRuntime::onConnection)
+            .def("on_connection",
+                 [](BoundNetworkRuntime &self, std::function<void(const std::shared_ptr<Connection> &)> callback) {
+                     self.onConnection([&self, callback](const std::shared_ptr<Connection> &connection) {
+                         self.attach(connection);
+                         callback(connection);
+                     });
+                 })
             .def("on_connection_lost", &NetworkRuntime::onConnectionLost)
-            .def("await_connection", &NetworkRuntime::awaitConnection)
+            .def("await_connection", [](BoundNetworkRuntime &self, int timeout_ms) {
+                     auto connection = self.awaitConnection(timeout_ms);
+                     if (connection) {
+                         self.attach(connection);
+                     }
+                     return connection;
+                 }, py::call_guard<py::gil_scoped_release>())
             .def("set_heartbeat_message", &NetworkRuntime::setHeartbeatMessage)
             .def("clear_heartbeat_message", &NetworkRuntime::clearHeartbeat);
 }
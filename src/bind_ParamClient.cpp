@@ -0,0 +1,210 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include "ProtocolClient.h"
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <variant>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Downloads the parameters of a component with the MAVLink parameter protocol. PARAM_VALUE messages are
+// collected on the receive thread into a table indexed by param_index; once the stream goes quiet,
+// the missing indices are requested with PARAM_REQUEST_READ, at most max_in_flight at a time so that
+// the answers do not overrun the link.
+class ParamClient : public ProtocolClient {
+public:
+    using Value = std::variant<int64_t, double>;
+
+private:
+    struct Param {
+        std::string name;
+        Value value;
+    };
+
+    // filled by the receive thread while a download is running
+    struct Table {
+        const bool bytewise;
+        std::mutex lock;
+        std::condition_variable cv;
+        int count = -1;
+        std::vector<std::optional<Param>> params;
+        std::size_t received = 0;
+        uint64_t updates = 0;
+
+        explicit Table(bool bytewise) : bytewise(bytewise) {}
+
+        bool complete() const {
+            return count >= 0 && received == static_cast<std::size_t>(count);
+        }
+    };
+
+    // Integer parameters are either packed into the bytes of param_value (MAV_PROTOCOL_CAPABILITY_PARAM_ENCODE_BYTEWISE)
+    // or converted to float (MAV_PROTOCOL_CAPABILITY_PARAM_ENCODE_C_CAST)
+    static Value _decode(const Message &message, bool bytewise) {
+        const auto type = message.get<uint8_t>("param_type");
+        const auto value = message.get<float>("param_value");
+        // MAV_PARAM_TYPE_UINT8 to MAV_PARAM_TYPE_INT32, wider types do not fit into param_value
+        if (type < 1 || type > 6) {
+            return static_cast<double>(value);
+        }
+        if (!bytewise) {
+            return static_cast<int64_t>(value);
+        }
+        const auto bits = message.getAsFloatUnpack<uint32_t>("param_value");
+        switch (type) {
+            case 1: return static_cast<int64_t>(static_cast<uint8_t>(bits));
+            case 2: return static_cast<int64_t>(static_cast<int8_t>(bits));
+            case 3: return static_cast<int64_t>(static_cast<uint16_t>(bits));
+            case 4: return static_cast<int64_t>(static_cast<int16_t>(bits));
+            case 5: return static_cast<int64_t>(bits);
+            default: return static_cast<int64_t>(static_cast<int32_t>(bits));
+        }
+    }
+
+    // Requests the missing indices, sending the next one whenever an answer arrives. Returns once all of them
+    // were answered, or when no answer came for timeout_ms; the next round requests what is still missing.
+    void _requestMissing(Table &table, const std::vector<int> &missing, int timeout_ms, std::size_t max_in_flight) {
+        std::size_t next = 0;
+        std::vector<int> in_flight;
+        while (true) {
+            while (in_flight.size() < max_in_flight && next < missing.size()) {
+                auto request_read = _create("PARAM_REQUEST_READ");
+                request_read.set("param_id", std::string());
+                request_read.set("param_index", static_cast<int16_t>(missing[next]));
+                _send(request_read);
+                in_flight.push_back(missing[next++]);
+            }
+            std::unique_lock lk{table.lock};
+            auto answered = [&table](int index) { return table.params[index].has_value(); };
+            if (!table.cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] {
+                return std::any_of(in_flight.begin(), in_flight.end(), answered);
+            })) {
+                return;
+            }
+            in_flight.erase(std::remove_if(in_flight.begin(), in_flight.end(), answered), in_flight.end());
+            if (in_flight.empty() && next == missing.size()) {
+                return;
+            }
+        }
+    }
+
+public:
+    using ProtocolClient::ProtocolClient;
+
+    std::map<std::string, Value> fetchAll(int timeout_ms, int retries, bool bytewise, std::size_t max_in_flight) {
+        if (max_in_flight == 0) {
+            throw std::invalid_argument("max_in_flight must be at least 1");
+        }
+        auto table = std::make_shared<Table>(bytewise);
+        auto handle = _connection->addMessageCallback([this, table](const Message &message) {
+            if (message.name() != "PARAM_VALUE" || !_fromTarget(message)) {
+                return;
+            }
+            const int count = message.get<uint16_t>("param_count");
+            const int index = message.get<uint16_t>("param_index");
+            std::lock_guard lg{table->lock};
+            if (table->count < 0) {
+                table->count = count;
+                table->params.resize(count);
+            }
+            // 65535 marks a parameter that was not sent as part of the list
+            if (index < table->count && !table->params[index]) {
+                table->params[index] = Param{message.get<std::string>("param_id"), _decode(message, table->bytewise)};
+                table->received++;
+            }
+            table->updates++;
+            table->cv.notify_all();
+        });
+        ScopeExit remove_callback{[this, handle] { _connection->removeMessageCallback(handle); }};
+
+        auto request_list = _create("PARAM_REQUEST_LIST");
+        _send(request_list);
+        for (int round = 0; ; round++) {
+            std::vector<int> missing;
+            {
+                std::unique_lock lk{table->lock};
+                // wait until the stream has been quiet for timeout_ms
+                uint64_t updates = table->updates;
+                while (!table->complete() && table->cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] {
+                    return table->updates != updates;
+                })) {
+                    updates = table->updates;
+                }
+                if (table->complete()) {
+                    std::map<std::string, Value> params;
+                    for (auto &param : table->params) {
+                        params.emplace(std::move(param->name), param->value);
+                    }
+                    return params;
+                }
+                if (round == retries) {
+                    throw TimeoutException("Received " + std::to_string(table->received) + " of " +
+                                           std::to_string(std::max(table->count, 0)) + " parameters");
+                }
+                for (int i = 0; i < table->count; i++) {
+                    if (!table->params[i]) {
+                        missing.push_back(i);
+                    }
+                }
+            }
+            if (missing.empty()) {
+                // not even the parameter count is known yet
+                _send(request_list);
+            } else {
+                _requestMissing(*table, missing, timeout_ms, max_in_flight);
+            }
+        }
+    }
+};
+
+
+void bind_ParamClient(py::module m) {
+    bindProtocolClient(py::class_<ParamClient>(m, "ParamClient"))
+            .def("fetch_all", &ParamClient::fetchAll, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("timeout_ms") = 1000, py::arg("retries") = 3, py::arg("bytewise") = true,
+                 py::arg("max_in_flight") = 8);
+}
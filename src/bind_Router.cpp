@@ -0,0 +1,234 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/Network.h"
+#include "mav/utils.h"
+#include "ConnectionState.h"
+#include "GilRelease.h"
+#include "LockedInterface.h"
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string_view>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Forwards frames between connections without entering python, following the MAVLink routing rules:
+// the router learns on which link each (system id, component id) was seen, broadcasts messages without
+// a target and sends targeted messages only to the links their target was seen on.
+// Frames are written through the LockedInterface of each link's runtime, so that they do not interleave
+// with the runtime's own frames on TCP and serial links.
+class Router {
+private:
+    struct Link {
+        std::shared_ptr<LockedInterface> interface;
+        std::shared_ptr<Connection> connection;
+        CallbackHandle handle{};
+        std::atomic<uint64_t> received{0};
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> unroutable{0};
+
+        Link(std::shared_ptr<LockedInterface> interface, std::shared_ptr<Connection> connection) :
+                interface(std::move(interface)), connection(std::move(connection)) {}
+    };
+
+    std::shared_mutex _lock;
+    std::vector<std::unique_ptr<Link>> _links;
+    // (system id << 8 | component id) -> links it was seen on
+    std::map<uint16_t, std::set<std::size_t>> _routes;
+
+    static uint16_t _key(int system_id, int component_id) {
+        return static_cast<uint16_t>((system_id << 8) | component_id);
+    }
+
+    // Copies the frame of a received message and recomputes its checksum, so that it can be sent as is
+    static uint32_t _frame(const Message &message, std::array<uint8_t, MessageDefinition::MAX_MESSAGE_SIZE> &buffer) {
+        auto header = message.header();
+        const uint32_t payload_end = MessageDefinition::HEADER_SIZE + header.len();
+        std::memcpy(buffer.data(), message.data(), payload_end);
+        CRC crc;
+        crc.accumulate(std::string_view(reinterpret_cast<const char *>(buffer.data() + 1), payload_end - 1));
+        const char crc_extra = static_cast<char>(message.type().crcExtra());
+        crc.accumulate(std::string_view(&crc_extra, 1));
+        const uint16_t checksum = crc.crc16();
+        buffer[payload_end] = static_cast<uint8_t>(checksum & 0xFF);
+        buffer[payload_end + 1] = static_cast<uint8_t>(checksum >> 8);
+        uint32_t size = payload_end + MessageDefinition::CHECKSUM_SIZE;
+        if (header.incompatFlags() & 0x01) {
+            std::memcpy(buffer.data() + size, message.data() + size, MessageDefinition::SIGNATURE_SIZE);
+            size += MessageDefinition::SIGNATURE_SIZE;
+        }
+        return size;
+    }
+
+    static int _target(const Message &message, const std::string &field) {
+        return message.type().containsField(field) ? message.get<uint8_t>(field) : 0;
+    }
+
+    void _learn(std::size_t source, const Message &message) {
+        const uint16_t key = _key(message.header().systemId(), message.header().componentId());
+        {
+            std::shared_lock lk{_lock};
+            auto it = _routes.find(key);
+            if (it != _routes.end() && it->second.count(source)) {
+                return;
+            }
+        }
+        std::unique_lock lk{_lock};
+        _routes[key].insert(source);
+    }
+
+    void _route(std::size_t source, const Message &message) {
+        _learn(source, message);
+
+        const int target_system = _target(message, "target_system");
+        const int target_component = _target(message, "target_component");
+        Link *source_link;
+        std::set<std::size_t> destinations;
+        std::vector<Link *> links;
+        {
+            std::shared_lock lk{_lock};
+            source_link = _links[source].get();
+            if (target_system == 0) {
+                for (std::size_t i = 0; i < _links.size(); i++) {
+                    destinations.insert(i);
+                }
+            } else {
+                auto first = _routes.lower_bound(_key(target_system, target_component));
+                auto last = target_component == 0 ?
+                        _routes.upper_bound(_key(target_system, 0xFF)) : _routes.upper_bound(_key(target_system, target_component));
+                for (auto it = first; it != last; ++it) {
+                    destinations.insert(it->second.begin(), it->second.end());
+                }
+            }
+            destinations.erase(source);
+            // links are never removed, so the pointers stay valid after unlocking
+            for (auto destination : destinations) {
+                links.push_back(_links[destination].get());
+            }
+        }
+        source_link->received.fetch_add(1, std::memory_order_relaxed);
+        if (links.empty()) {
+            if (target_system != 0) {
+                source_link->unroutable.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        std::array<uint8_t, MessageDefinition::MAX_MESSAGE_SIZE> buffer;
+        const uint32_t size = _frame(message, buffer);
+        for (auto link : links) {
+            try {
+                link->interface->send(buffer.data(), size, link->connection->partner());
+                link->sent.fetch_add(1, std::memory_order_relaxed);
+            } catch (const NetworkError &) {
+                // a broken link must not keep the others from receiving the frame
+            }
+        }
+    }
+
+public:
+    Router() = default;
+    Router(const Router &) = delete;
+    Router &operator=(const Router &) = delete;
+
+    ~Router() {
+        // a python callback on one of the connections might be waiting for the GIL while libmav holds
+        // the callback lock that removing ours needs
+        ReleaseGilIfHeld release;
+        for (auto &link : _links) {
+            link->connection->removeMessageCallback(link->handle);
+        }
+    }
+
+    std::size_t addLink(NetworkInterface &interface, const std::shared_ptr<Connection> &connection) {
+        auto locked_interface = std::atomic_load(&connectionState(connection)->interface);
+        if (!locked_interface || &locked_interface->inner() != &interface) {
+            throw std::invalid_argument("The connection does not belong to a NetworkRuntime on this interface");
+        }
+        std::size_t index;
+        {
+            std::unique_lock lk{_lock};
+            index = _links.size();
+            _links.push_back(std::make_unique<Link>(std::move(locked_interface), connection));
+        }
+        auto handle = connection->addMessageCallback([this, index](const Message &message) {
+            _route(index, message);
+        });
+        std::unique_lock lk{_lock};
+        _links[index]->handle = handle;
+        return index;
+    }
+
+    std::map<std::pair<int, int>, std::vector<std::size_t>> routes() {
+        std::shared_lock lk{_lock};
+        std::map<std::pair<int, int>, std::vector<std::size_t>> routes;
+        for (const auto &[key, links] : _routes) {
+            routes[{key >> 8, key & 0xFF}] = {links.begin(), links.end()};
+        }
+        return routes;
+    }
+
+    std::vector<std::map<std::string, uint64_t>> stats() {
+        std::shared_lock lk{_lock};
+        std::vector<std::map<std::string, uint64_t>> stats;
+        for (const auto &link : _links) {
+            stats.push_back({{"received", link->received.load(std::memory_order_relaxed)},
+                             {"sent", link->sent.load(std::memory_order_relaxed)},
+                             {"unroutable", link->unroutable.load(std::memory_order_relaxed)}});
+        }
+        return stats;
+    }
+};
+
+
+void bind_Router(py::module m) {
+    py::class_<Router>(m, "Router")
+            .def(py::init<>())
+            .def("add_link", &Router::addLink, py::keep_alive<1, 2>(), py::call_guard<py::gil_scoped_release>(),
+                 py::arg("interface"), py::arg("connection"))
+            .def("routes", &Router::routes, py::call_guard<py::gil_scoped_release>())
+            .def("stats", &Router::stats, py::call_guard<py::gil_scoped_release>());
+}
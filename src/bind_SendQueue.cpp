@@ -0,0 +1,294 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "ConnectionState.h"
+#include "GilRelease.h"
+#include <deque>
+#include <array>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Bounded queue of outgoing messages, written to the connection by its own thread, so that
+// a congested link shows up as backpressure to the caller instead of blocking it in send.
+// Messages are kept in priority lanes; the writer always takes from the highest non-empty lane,
+// optionally paced to a byte rate so that a slow radio link is not overrun.
+class SendQueue {
+public:
+    static constexpr int PRIORITY_HIGH = 0;
+    static constexpr int PRIORITY_NORMAL = 1;
+    static constexpr int PRIORITY_BULK = 2;
+    static constexpr int NUM_LANES = 3;
+
+private:
+    struct Lane {
+        std::deque<Message> messages;
+        std::size_t high_water = 0;
+        uint64_t sent = 0;
+        uint64_t rejected = 0;
+    };
+
+    std::shared_ptr<Connection> _connection;
+    std::shared_ptr<ConnectionState> _state;
+    const std::size_t _max_depth;
+    const std::map<int, int> _priorities;
+    const double _max_bytes_per_second;
+    std::array<Lane, NUM_LANES> _lanes;
+    std::mutex _lock;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::condition_variable _drained;
+    bool _stop = false;
+    bool _writing = false;
+    uint64_t _errors = 0;
+    // token bucket for pacing, in bytes
+    double _tokens = 0;
+    std::chrono::steady_clock::time_point _last_refill = std::chrono::steady_clock::now();
+    std::thread _thread;
+
+    bool _empty() const {
+        return std::all_of(_lanes.begin(), _lanes.end(), [](const Lane &lane) { return lane.messages.empty(); });
+    }
+
+    // time at which the token bucket allows the next write
+    std::chrono::steady_clock::time_point _nextWriteTime() {
+        auto now = std::chrono::steady_clock::now();
+        if (_max_bytes_per_second <= 0) {
+            return now;
+        }
+        double burst = std::max(_max_bytes_per_second / 10, static_cast<double>(MessageDefinition::MAX_MESSAGE_SIZE));
+        _tokens = std::min(burst, _tokens +
+                std::chrono::duration<double>(now - _last_refill).count() * _max_bytes_per_second);
+        _last_refill = now;
+        if (_tokens >= 0) {
+            return now;
+        }
+        return now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(-_tokens / _max_bytes_per_second));
+    }
+
+    void _run() {
+        std::unique_lock lk{_lock};
+        while (true) {
+            _not_empty.wait(lk, [this] { return _stop || !_empty(); });
+            // what is still queued on destruction is discarded, a paced or blocked link could take minutes to drain
+            if (_stop) {
+                return;
+            }
+            auto write_time = _nextWriteTime();
+            if (write_time > std::chrono::steady_clock::now()) {
+                _not_empty.wait_until(lk, write_time);
+                continue;
+            }
+            auto lane = std::find_if(_lanes.begin(), _lanes.end(),
+                                     [](const Lane &lane) { return !lane.messages.empty(); });
+            Message message = std::move(lane->messages.front());
+            lane->messages.pop_front();
+            _writing = true;
+            lk.unlock();
+            _not_full.notify_all();
+            bool ok = true;
+            try {
+                _connection->send(message);
+            } catch (const std::exception &) {
+                ok = false;
+            }
+            lk.lock();
+            _writing = false;
+            if (ok) {
+                _state->stats.recordSent(message);
+                lane->sent++;
+                _tokens -= message.header().len() + MessageDefinition::HEADER_SIZE + MessageDefinition::CHECKSUM_SIZE;
+            } else {
+                _errors++;
+            }
+            if (_empty()) {
+                _drained.notify_all();
+            }
+        }
+    }
+
+    Lane &_laneFor(const Message &message, int priority) {
+        if (priority < 0) {
+            auto it = _priorities.find(message.id());
+            priority = it != _priorities.end() ? it->second : PRIORITY_NORMAL;
+        }
+        return _lanes[std::clamp(priority, 0, NUM_LANES - 1)];
+    }
+
+    void _enqueue(Lane &lane, const Message &message) {
+        lane.messages.push_back(message);
+        lane.high_water = std::max(lane.high_water, lane.messages.size());
+        _not_empty.notify_one();
+    }
+
+public:
+    SendQueue(std::shared_ptr<Connection> connection, std::size_t max_depth,
+              std::map<int, int> priorities, double max_bytes_per_second) :
+            _connection(std::move(connection)),
+            _state(connectionState(_connection)),
+            _max_depth(std::max<std::size_t>(max_depth, 1)),
+            _priorities(std::move(priorities)),
+            _max_bytes_per_second(max_bytes_per_second) {
+        _thread = std::thread{&SendQueue::_run, this};
+    }
+
+    ~SendQueue() {
+        {
+            std::lock_guard lg{_lock};
+            _stop = true;
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+        joinReleasingGil(_thread);
+    }
+
+    void send(const Message &message, int timeout_ms, int priority) {
+        std::unique_lock lk{_lock};
+        auto &lane = _laneFor(message, priority);
+        auto has_room = [this, &lane] { return _stop || lane.messages.size() < _max_depth; };
+        if (timeout_ms < 0) {
+            _not_full.wait(lk, has_room);
+        } else if (!_not_full.wait_for(lk, std::chrono::milliseconds(timeout_ms), has_room)) {
+            lane.rejected++;
+            throw TimeoutException("Send queue full");
+        }
+        _enqueue(lane, message);
+    }
+
+    bool sendNowait(const Message &message, int priority) {
+        std::lock_guard lg{_lock};
+        auto &lane = _laneFor(message, priority);
+        if (lane.messages.size() >= _max_depth) {
+            lane.rejected++;
+            return false;
+        }
+        _enqueue(lane, message);
+        return true;
+    }
+
+    // waits until all queued messages have been written
+    bool flush(int timeout_ms) {
+        std::unique_lock lk{_lock};
+        auto drained = [this] { return _empty() && !_writing; };
+        if (timeout_ms < 0) {
+            _drained.wait(lk, drained);
+            return true;
+        }
+        return _drained.wait_for(lk, std::chrono::milliseconds(timeout_ms), drained);
+    }
+
+    std::size_t depth() {
+        std::lock_guard lg{_lock};
+        std::size_t depth = 0;
+        for (const auto &lane : _lanes) {
+            depth += lane.messages.size();
+        }
+        return depth;
+    }
+
+    py::dict stats() {
+        struct LaneStats {
+            std::size_t depth;
+            std::size_t high_water;
+            uint64_t sent;
+            uint64_t rejected;
+        };
+        std::array<LaneStats, NUM_LANES> lanes{};
+        uint64_t errors;
+        {
+            py::gil_scoped_release release;
+            std::lock_guard lg{_lock};
+            for (int i = 0; i < NUM_LANES; i++) {
+                lanes[i] = {_lanes[i].messages.size(), _lanes[i].high_water, _lanes[i].sent, _lanes[i].rejected};
+            }
+            errors = _errors;
+        }
+        py::list lane_stats;
+        LaneStats total{};
+        for (const auto &lane : lanes) {
+            py::dict l;
+            l["depth"] = lane.depth;
+            l["high_water"] = lane.high_water;
+            l["sent"] = lane.sent;
+            l["rejected"] = lane.rejected;
+            lane_stats.append(l);
+            total.depth += lane.depth;
+            total.high_water = std::max(total.high_water, lane.high_water);
+            total.sent += lane.sent;
+            total.rejected += lane.rejected;
+        }
+        py::dict d;
+        d["depth"] = total.depth;
+        d["max_depth"] = _max_depth;
+        d["high_water"] = total.high_water;
+        d["sent"] = total.sent;
+        d["rejected"] = total.rejected;
+        d["errors"] = errors;
+        d["lanes"] = lane_stats;
+        return d;
+    }
+};
+
+
+void bind_SendQueue(py::module m) {
+    py::class_<SendQueue>(m, "SendQueue")
+            .def(py::init<std::shared_ptr<Connection>, std::size_t, std::map<int, int>, double>(),
+                 py::arg("connection"), py::arg("max_depth") = 256,
+                 // COMMAND_INT and COMMAND_LONG
+                 py::arg("priorities") = std::map<int, int>{{75, SendQueue::PRIORITY_HIGH},
+                                                           {76, SendQueue::PRIORITY_HIGH}},
+                 py::arg("max_bytes_per_second") = 0)
+            .def("send", &SendQueue::send, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("message"), py::arg("timeout_ms") = -1, py::arg("priority") = -1)
+            .def("send_nowait", &SendQueue::sendNowait, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("message"), py::arg("priority") = -1)
+            .def("flush", &SendQueue::flush, py::call_guard<py::gil_scoped_release>(),
+                 py::arg("timeout_ms") = -1)
+            .def("stats", &SendQueue::stats)
+            .def("__len__", &SendQueue::depth, py::call_guard<py::gil_scoped_release>())
+            .def_readonly_static("PRIORITY_HIGH", &SendQueue::PRIORITY_HIGH)
+            .def_readonly_static("PRIORITY_NORMAL", &SendQueue::PRIORITY_NORMAL)
+            .def_readonly_static("PRIORITY_BULK", &SendQueue::PRIORITY_BULK);
+}
@@ -0,0 +1,252 @@
+/****************************************************************************
+ * 
+ * Copyright (c) 2023, libmav development team
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without 
+ * modification, are permitted provided that the following conditions 
+ * are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright 
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright 
+ *    notice, this list of conditions and the following disclaimer in 
+ *    the documentation and/or other materials provided with the 
+ *    distribution.
+ * 3. Neither the name libmav nor the names of its contributors may be 
+ *    used to endorse or promote products derived from this software 
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE 
+ * COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS 
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED 
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ * POSSIBILITY OF SUCH DAMAGE.
+ * 
+ ****************************************************************************/
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include "mav/Connection.h"
+#include "mav/MessageSet.h"
+#include "ConnectionState.h"
+#include "GilRelease.h"
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace py = pybind11;
+using namespace mav;
+using namespace libmav_python;
+
+
+// Estimates the clock offset to every system on a connection with the MAVLink TIMESYNC protocol.
+// Requests from the vehicle are answered right on the receive thread, and our own requests are sent
+// by a timer thread, so that the GIL never adds to the measured round trip.
+// Local time is the monotonic clock, the same as Message.receive_time_ns and time.monotonic_ns().
+class TimeSync {
+public:
+    struct Estimate {
+        int64_t offset_ns = 0;
+        int64_t rtt_ns = 0;
+        uint64_t samples = 0;
+        uint64_t rejected = 0;
+        // samples since the filter (re)started converging, and rejections since the last accepted sample
+        uint64_t converging_samples = 0;
+        uint64_t rejected_in_row = 0;
+    };
+
+private:
+    // samples converge fast at first, then the filter settles
+    static constexpr uint64_t CONVERGENCE_SAMPLES = 5;
+    static constexpr double ALPHA_CONVERGING = 0.5;
+    static constexpr double ALPHA_SETTLED = 0.05;
+    // samples with a round trip this many times the filtered one are dominated by queueing, not the clocks
+    static constexpr double MAX_RTT_FACTOR = 2.0;
+    // unless they keep coming: then the link itself got slower, and the filter converges again
+    static constexpr uint64_t MAX_REJECTED_IN_ROW = 8;
+    static constexpr std::size_t MAX_PENDING_REQUESTS = 16;
+
+    std::shared_ptr<Connection> _connection;
+    std::shared_ptr<ConnectionState> _state;
+    const MessageSet &_message_set;
+    const std::chrono::milliseconds _interval;
+    const bool _respond;
+    std::mutex _lock;
+    std::map<int, Estimate> _estimates;
+    // ts1 of our recent requests, so that answers to other systems' requests are not taken for ours
+    std::array<int64_t, MAX_PENDING_REQUESTS> _pending{};
+    std::size_t _next_pending = 0;
+    CallbackHandle _handle;
+    std::condition_variable _cv;
+    bool _stop = false;
+    std::thread _thread;
+
+    static int64_t _now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void _send(int64_t tc1, int64_t ts1, int target_system = 0, int target_component = 0) {
+        auto message = _message_set.create("TIMESYNC");
+        message.set("tc1", tc1);
+        message.set("ts1", ts1);
+        // extension fields, missing in older dialects
+        if (message.type().containsField("target_system")) {
+            message.set("target_system", static_cast<uint8_t>(target_system));
+            message.set("target_component", static_cast<uint8_t>(target_component));
+        }
+        _connection->send(message);
+        _state->stats.recordSent(message);
+    }
+
+    void _consume(const Message &message) {
+        const int64_t now = _now();
+        const auto tc1 = message.get<int64_t>("tc1");
+        const auto ts1 = message.get<int64_t>("ts1");
+        if (tc1 == 0) {
+            // answered on the receive thread, so the send and its traffic accounting run there too
+            if (_respond) {
+                _send(now, ts1, message.header().systemId(), message.header().componentId());
+            }
+            return;
+        }
+        std::lock_guard lg{_lock};
+        if (ts1 == 0 || std::find(_pending.begin(), _pending.end(), ts1) == _pending.end()) {
+            return;
+        }
+        const int64_t rtt = now - ts1;
+        const int64_t offset = tc1 + rtt / 2 - now;
+        Estimate &estimate = _estimates[message.header().systemId()];
+        if (estimate.converging_samples >= CONVERGENCE_SAMPLES &&
+            static_cast<double>(rtt) > MAX_RTT_FACTOR * static_cast<double>(estimate.rtt_ns)) {
+            if (++estimate.rejected_in_row < MAX_REJECTED_IN_ROW) {
+                estimate.rejected++;
+                return;
+            }
+            estimate.converging_samples = 0;
+        }
+        estimate.rejected_in_row = 0;
+        if (estimate.converging_samples == 0) {
+            estimate.offset_ns = offset;
+            estimate.rtt_ns = rtt;
+        } else {
+            const double alpha = estimate.converging_samples < CONVERGENCE_SAMPLES ? ALPHA_CONVERGING : ALPHA_SETTLED;
+            estimate.offset_ns += static_cast<int64_t>(alpha * static_cast<double>(offset - estimate.offset_ns));
+            estimate.rtt_ns += static_cast<int64_t>(alpha * static_cast<double>(rtt - estimate.rtt_ns));
+        }
+        estimate.samples++;
+        estimate.converging_samples++;
+    }
+
+    void _run() {
+        std::unique_lock lk{_lock};
+        while (!_stop) {
+            const int64_t ts1 = _now();
+            _pending[_next_pending] = ts1;
+            _next_pending = (_next_pending + 1) % MAX_PENDING_REQUESTS;
+            lk.unlock();
+            try {
+                _send(0, ts1);
+            } catch (const std::exception &) {
+                // the link is down, the next request tries again
+            }
+            lk.lock();
+            _cv.wait_for(lk, _interval, [this] { return _stop; });
+        }
+    }
+
+public:
+    TimeSync(std::shared_ptr<Connection> connection, const MessageSet &message_set, int interval_ms, bool respond) :
+            _connection(std::move(connection)),
+            _state(connectionState(_connection)),
+            _message_set(message_set),
+            _interval(interval_ms),
+            _respond(respond) {
+        _handle = _connection->addMessageCallback([this](const Message &message) {
+            if (message.name() == "TIMESYNC") {
+                _consume(message);
+            }
+        });
+        if (interval_ms > 0) {
+            _thread = std::thread{&TimeSync::_run, this};
+        }
+    }
+
+    ~TimeSync() {
+        // removing the callback waits for other callbacks on the connection, which might be waiting for the GIL
+        ReleaseGilIfHeld release;
+        _connection->removeMessageCallback(_handle);
+        if (_thread.joinable()) {
+            {
+                std::lock_guard lg{_lock};
+                _stop = true;
+            }
+            _cv.notify_all();
+            _thread.join();
+        }
+    }
+
+    std::optional<Estimate> estimate(int system_id) {
+        std::lock_guard lg{_lock};
+        auto it = _estimates.find(system_id);
+        if (it == _estimates.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    std::map<int, Estimate> estimates() {
+        std::lock_guard lg{_lock};
+        return _estimates;
+    }
+};
+
+
+void bind_TimeSync(py::module m) {
+    auto estimate_to_dict = [](const TimeSync::Estimate &estimate) {
+        return py::dict(py::arg("offset_ns") = estimate.offset_ns,
+                        py::arg("rtt_ns") = estimate.rtt_ns,
+                        py::arg("samples") = estimate.samples,
+                        py::arg("rejected") = estimate.rejected);
+    };
+
+    py::class_<TimeSync>(m, "TimeSync")
+            .def(py::init<std::shared_ptr<Connection>, const MessageSet &, int, bool>(), py::keep_alive<1, 3>(),
+                 py::arg("connection"), py::arg("message_set"), py::arg("interval_ms") = 1000, py::arg("respond") = true)
+            .def("estimates", [estimate_to_dict](TimeSync &self) {
+                auto estimates = [&self] {
+                    py::gil_scoped_release release;
+                    return self.estimates();
+                }();
+                py::dict result;
+                for (const auto &[system_id, estimate] : estimates) {
+                    result[py::int_(system_id)] = estimate_to_dict(estimate);
+                }
+                return result;
+            })
+            .def("offset_ns", [](TimeSync &self, int system_id) -> std::optional<int64_t> {
+                auto estimate = self.estimate(system_id);
+                if (!estimate) {
+                    return std::nullopt;
+                }
+                return estimate->offset_ns;
+            }, py::arg("system_id"))
+            .def("to_host_ns", [](TimeSync &self, int system_id, int64_t remote_ns) {
+                auto estimate = self.estimate(system_id);
+                if (!estimate) {
+                    throw std::invalid_argument("No time sync with system " + std::to_string(system_id) + " yet");
+                }
+                return remote_ns - estimate->offset_ns;
+            }, py::arg("system_id"), py::arg("remote_ns"));
+}
@@ -47,6 +47,14 @@ void bind_MessageDefinition(py::module);
 void bind_NetworkRuntime(py::module);
 void bind_Connection(py::module);
 void bind_PhysicalNetwork(py::module);
+void bind_SendQueue(py::module);
+void bind_Router(py::module);
+void bind_ParamClient(py::module);
+void bind_MissionClient(py::module);
+void bind_FtpClient(py::module);
+void bind_LogDownloader(py::module);
+void bind_TimeSync(py::module);
+void bind_EmissionScheduler(py::module);
 
 
 PYBIND11_MODULE(libmav, m) {
@@ -67,6 +75,14 @@ PYBIND11_MODULE(libmav, m) {
     bind_NetworkRuntime(m);
     bind_Connection(m);
     bind_PhysicalNetwork(m);
+    bind_SendQueue(m);
+    bind_Router(m);
+    bind_ParamClient(m);
+    bind_MissionClient(m);
+    bind_FtpClient(m);
+    bind_LogDownloader(m);
+    bind_TimeSync(m);
+    bind_EmissionScheduler(m);
 
 
 #ifdef VERSION_INFO
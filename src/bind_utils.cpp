@@ -41,6 +41,9 @@ using namespace mav;
 
 
 void bind_utils(py::module m) {
+    // a RuntimeError subclass, so that code catching RuntimeError keeps working
+    py::register_exception<TimeoutException>(m, "TimeoutException", PyExc_RuntimeError);
+
     py::class_<CRC>(m, "CRC")
             .def(py::init<>())
             .def("accumulate", static_cast<void (CRC::*)(const std::string_view&)>(&CRC::accumulate), "Bla")
@@ -1,5 +1,13 @@
+import asyncio
+import collections
+import os
+import socket
+import struct
+import tempfile
+import threading
 import unittest
 import sys
+import time
 sys.path.append('./cmake-build-debug')
 
 import libmav
@@ -41,6 +49,142 @@ BIG_MESSAGE = '''
 </mavlink>
 '''
 
+PROTOCOL_MESSAGES = '''
+<mavlink>
+    <messages>
+        <message id="76" name="COMMAND_LONG">
+            <field type="uint8_t" name="target_system">System which should execute the command</field>
+            <field type="uint8_t" name="target_component">Component which should execute the command, 0 for all components</field>
+            <field type="uint16_t" name="command">Command ID (of command to send).</field>
+            <field type="uint8_t" name="confirmation">0: First transmission of this command. 1-255: Confirmation transmissions (e.g. for kill command)</field>
+            <field type="float" name="param1">Parameter 1 (for the specific command).</field>
+            <field type="float" name="param2">Parameter 2 (for the specific command).</field>
+            <field type="float" name="param3">Parameter 3 (for the specific command).</field>
+            <field type="float" name="param4">Parameter 4 (for the specific command).</field>
+            <field type="float" name="param5">Parameter 5 (for the specific command).</field>
+            <field type="float" name="param6">Parameter 6 (for the specific command).</field>
+            <field type="float" name="param7">Parameter 7 (for the specific command).</field>
+        </message>
+        <message id="77" name="COMMAND_ACK">
+            <field type="uint16_t" name="command">Command ID (of acknowledged command).</field>
+            <field type="uint8_t" name="result">Result of command.</field>
+            <extensions/>
+            <field type="uint8_t" name="progress">The progress percentage when result is MAV_RESULT_IN_PROGRESS.</field>
+            <field type="int32_t" name="result_param2">Additional result information.</field>
+            <field type="uint8_t" name="target_system">System ID of the target recipient.</field>
+            <field type="uint8_t" name="target_component">Component ID of the target recipient.</field>
+        </message>
+        <message id="20" name="PARAM_REQUEST_READ">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="char[16]" name="param_id">Onboard parameter id</field>
+            <field type="int16_t" name="param_index">Parameter index. Send -1 to use the param ID field as identifier</field>
+        </message>
+        <message id="21" name="PARAM_REQUEST_LIST">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+        </message>
+        <message id="22" name="PARAM_VALUE">
+            <field type="char[16]" name="param_id">Onboard parameter id</field>
+            <field type="float" name="param_value">Onboard parameter value</field>
+            <field type="uint8_t" name="param_type">Onboard parameter type.</field>
+            <field type="uint16_t" name="param_count">Total number of onboard parameters</field>
+            <field type="uint16_t" name="param_index">Index of this onboard parameter</field>
+        </message>
+        <message id="43" name="MISSION_REQUEST_LIST">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <extensions/>
+            <field type="uint8_t" name="mission_type">Mission type.</field>
+        </message>
+        <message id="44" name="MISSION_COUNT">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint16_t" name="count">Number of mission items in the sequence</field>
+            <extensions/>
+            <field type="uint8_t" name="mission_type">Mission type.</field>
+            <field type="uint32_t" name="opaque_id">Id of current on-vehicle mission, fence, or rally point plan</field>
+        </message>
+        <message id="47" name="MISSION_ACK">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint8_t" name="type">Mission result.</field>
+            <extensions/>
+            <field type="uint8_t" name="mission_type">Mission type.</field>
+            <field type="uint32_t" name="opaque_id">Id of new on-vehicle mission, fence, or rally point plan</field>
+        </message>
+        <message id="51" name="MISSION_REQUEST_INT">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint16_t" name="seq">Sequence</field>
+            <extensions/>
+            <field type="uint8_t" name="mission_type">Mission type.</field>
+        </message>
+        <message id="73" name="MISSION_ITEM_INT">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint16_t" name="seq">Waypoint ID (sequence number).</field>
+            <field type="uint8_t" name="frame">The coordinate system of the waypoint.</field>
+            <field type="uint16_t" name="command">The scheduled action for the waypoint.</field>
+            <field type="uint8_t" name="current">false:0, true:1</field>
+            <field type="uint8_t" name="autocontinue">Autocontinue to next waypoint. 0: false, 1: true.</field>
+            <field type="float" name="param1">PARAM1, see MAV_CMD enum</field>
+            <field type="float" name="param2">PARAM2, see MAV_CMD enum</field>
+            <field type="float" name="param3">PARAM3, see MAV_CMD enum</field>
+            <field type="float" name="param4">PARAM4, see MAV_CMD enum</field>
+            <field type="int32_t" name="x">PARAM5 / local: x position in meters * 1e4, global: latitude in degrees * 10^7</field>
+            <field type="int32_t" name="y">PARAM6 / y position: local: x position in meters * 1e4, global: longitude in degrees *10^7</field>
+            <field type="float" name="z">PARAM7 / z position: global: altitude in meters (relative or absolute, depending on frame.</field>
+            <extensions/>
+            <field type="uint8_t" name="mission_type">Mission type.</field>
+        </message>
+        <message id="110" name="FILE_TRANSFER_PROTOCOL">
+            <field type="uint8_t" name="target_network">Network ID (0 for broadcast)</field>
+            <field type="uint8_t" name="target_system">System ID (0 for broadcast)</field>
+            <field type="uint8_t" name="target_component">Component ID (0 for broadcast)</field>
+            <field type="uint8_t[251]" name="payload">Variable length payload.</field>
+        </message>
+        <message id="117" name="LOG_REQUEST_LIST">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint16_t" name="start">First log id (0 for first available)</field>
+            <field type="uint16_t" name="end">Last log id (0xffff for last available)</field>
+        </message>
+        <message id="118" name="LOG_ENTRY">
+            <field type="uint16_t" name="id">Log id</field>
+            <field type="uint16_t" name="num_logs">Total number of logs</field>
+            <field type="uint16_t" name="last_log_num">High log number</field>
+            <field type="uint32_t" name="time_utc">UTC timestamp of log since 1970, or 0 if not available</field>
+            <field type="uint32_t" name="size">Size of the log (may be approximate)</field>
+        </message>
+        <message id="119" name="LOG_REQUEST_DATA">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+            <field type="uint16_t" name="id">Log id (from LOG_ENTRY reply)</field>
+            <field type="uint32_t" name="ofs">Offset into the log</field>
+            <field type="uint32_t" name="count">Number of bytes</field>
+        </message>
+        <message id="120" name="LOG_DATA">
+            <field type="uint16_t" name="id">Log id (from LOG_ENTRY reply)</field>
+            <field type="uint32_t" name="ofs">Offset into the log</field>
+            <field type="uint8_t" name="count">Number of bytes (zero for end of log)</field>
+            <field type="uint8_t[90]" name="data">log data</field>
+        </message>
+        <message id="122" name="LOG_REQUEST_END">
+            <field type="uint8_t" name="target_system">System ID</field>
+            <field type="uint8_t" name="target_component">Component ID</field>
+        </message>
+        <message id="111" name="TIMESYNC">
+            <field type="int64_t" name="tc1">Time sync timestamp 1. Syncing: 0. Responding: Timestamp of responding component.</field>
+            <field type="int64_t" name="ts1">Time sync timestamp 2. Timestamp of syncing component.</field>
+            <extensions/>
+            <field type="uint8_t" name="target_system">Target sysid for response.</field>
+            <field type="uint8_t" name="target_component">Target component for response.</field>
+        </message>
+    </messages>
+</mavlink>
+'''
+
 
 class TestMessageSet(unittest.TestCase):
     def testMessageSet(self):
@@ -130,10 +274,51 @@ class TestMessage(unittest.TestCase):
         output = message.to_dict()
         self.assertEqual(original, output)
 
+def crc_accumulate(data, crc=0xFFFF):
+    for byte in data:
+        tmp = byte ^ (crc & 0xFF)
+        tmp = (tmp ^ (tmp << 4)) & 0xFF
+        crc = ((crc >> 8) ^ (tmp << 8) ^ (tmp << 3) ^ (tmp >> 4)) & 0xFFFF
+    return crc
+
+
+def heartbeat_frame(seq, system_id, component_id=1):
+    """MAVLink 2 HEARTBEAT frame with a chosen sequence number."""
+    payload = struct.pack('<IBBBBB', 4, 1, 2, 3, 5, 6)
+    header = struct.pack('<BBBBBBB', len(payload), 0, 0, seq & 0xFF, system_id, component_id, 0) + b'\x00\x00'
+    crc = crc_accumulate(bytes([50]), crc_accumulate(header + payload))
+    return b'\xfd' + header + payload + struct.pack('<H', crc)
+
+
+Link = collections.namedtuple('Link', ['server_physical', 'server_conn', 'client_physical', 'client_conn'])
+
+
+def free_port(kind=socket.SOCK_STREAM):
+    with socket.socket(socket.AF_INET, kind) as sock:
+        sock.bind(('127.0.0.1', 0))
+        return sock.getsockname()[1]
+
+
+def wait_until(condition, timeout_s=2.0):
+    deadline = time.monotonic() + timeout_s
+    while not condition():
+        if time.monotonic() > deadline:
+            return False
+        time.sleep(0.005)
+    return True
+
+
+def collect(queue, count, name='BIG_MESSAGE', timeout_s=2.0):
+    received = []
+    wait_until(lambda: received.extend(msg for msg in queue if msg.name == name) or len(received) >= count, timeout_s)
+    return received
+
+
 class TestPhysical(unittest.TestCase):
     def setUp(self) -> None:
         self.message_set = libmav.MessageSet()
         self.message_set.add_from_xml_string(BIG_MESSAGE)
+        self.message_set.add_from_xml_string(PROTOCOL_MESSAGES)
 
         self.big_message = self.message_set.create('BIG_MESSAGE').set_from_dict({
             'uint8_field': 1,
@@ -150,6 +335,44 @@ class TestPhysical(unittest.TestCase):
             'float_arr_field': [1.0, 2.0, 3.0],
             'int32_arr_field': [4, 5, 6]
         })
+        self.heartbeat = self.message_set.create('HEARTBEAT').set_from_dict({
+            'type': 1,
+            'autopilot': 2,
+            'base_mode': 3,
+            'custom_mode': 4,
+            'system_status': 5,
+            'mavlink_version': 6
+        })
+        # keeps interfaces and runtimes alive until the end of the test
+        self.runtimes = []
+
+    def link(self, client_id=None, udp=False):
+        """Connects a client runtime to a server runtime over loopback on a free port."""
+        if udp:
+            port = free_port(socket.SOCK_DGRAM)
+            server_physical = libmav.UDPServer(port)
+            client_physical = libmav.UDPClient('127.0.0.1', port)
+        else:
+            port = free_port()
+            server_physical = libmav.TCPServer(port)
+            client_physical = libmav.TCPClient('127.0.0.1', port)
+        server_runtime = libmav.NetworkRuntime(self.message_set, self.heartbeat, server_physical)
+        if client_id is None:
+            client_runtime = libmav.NetworkRuntime(self.message_set, self.heartbeat, client_physical)
+        else:
+            client_runtime = libmav.NetworkRuntime(client_id, self.message_set, self.heartbeat, client_physical)
+        self.runtimes += [server_physical, server_runtime, client_physical, client_runtime]
+
+        server_conn = server_runtime.await_connection(2000)
+        client_conn = client_runtime.await_connection(2000)
+        self.assertIsNotNone(server_conn)
+        self.assertIsNotNone(client_conn)
+        return Link(server_physical, server_conn, client_physical, client_conn)
+
+    def connect(self, client_id=None, udp=False):
+        """Returns the (server, client) connections of a new loopback link."""
+        link = self.link(client_id, udp)
+        return link.server_conn, link.client_conn
 
     def testTCPConnection(self):
 
@@ -210,6 +433,653 @@ class TestPhysical(unittest.TestCase):
         response = server_conn.receive(expectation, 100)
         self.assertEqual(self.big_message.to_dict(), response.to_dict())
 
+    def testReceiveAny(self):
+        server_conn, client_conn = self.connect()
+
+        never = client_conn.expect(12345)
+        expectation = client_conn.expect('BIG_MESSAGE')
+        server_conn.send(self.big_message)
+        index, response = client_conn.receive_any([never, expectation], 100)
+        self.assertEqual(index, 1)
+        self.assertEqual(self.big_message.to_dict(), response.to_dict())
+        with self.assertRaises(RuntimeError):
+            client_conn.receive_any([never], 50)
+
+    def testExpectWhere(self):
+        server_conn, client_conn = self.connect()
+
+        mismatch = client_conn.expect('BIG_MESSAGE', where={'uint16_field': 4})
+        expectation = client_conn.expect('BIG_MESSAGE', where={'uint16_field': 3, 'char_arr_field': 'Hello world'})
+        server_conn.send(self.big_message)
+        response = client_conn.receive(expectation, 100)
+        self.assertEqual(self.big_message.to_dict(), response.to_dict())
+        with self.assertRaises(RuntimeError):
+            client_conn.receive(mismatch, 50)
+
+        with self.assertRaises(KeyError):
+            client_conn.expect('BIG_MESSAGE', where={'uint16_fild': 3})
+        with self.assertRaises(TypeError):
+            client_conn.expect('BIG_MESSAGE', where={'uint16_field': 'three'})
+        with self.assertRaises(TypeError):
+            client_conn.expect('BIG_MESSAGE', where={'int32_arr_field': 3})
+
+        # None is no constraint, as the default
+        expectation = client_conn.expect('BIG_MESSAGE', where=None)
+        server_conn.send(self.big_message)
+        self.assertEqual(self.big_message.to_dict(), client_conn.receive(expectation, 100).to_dict())
+
+        self.big_message['float_field'] = 0.1
+        expectation = client_conn.expect('BIG_MESSAGE', where={'float_field': 0.1})
+        server_conn.send(self.big_message)
+        self.assertEqual(self.big_message.to_dict(), client_conn.receive(expectation, 100).to_dict())
+
+    def testSendMany(self):
+        server_conn, client_conn = self.connect()
+
+        queue = libmav.MessageQueue(client_conn)
+        batch = []
+        for i in range(5):
+            batch.append(self.message_set.create('BIG_MESSAGE').set_from_dict(self.big_message.to_dict()))
+            batch[-1]['uint8_field'] = i
+        server_conn.send_many(batch)
+        received = collect(queue, 5)
+        self.assertEqual([msg['uint8_field'] for msg in received], [0, 1, 2, 3, 4])
+
+        with self.assertRaises(TypeError):
+            server_conn.send_many([self.big_message, None])
+
+    def testStats(self):
+        server_conn, client_conn = self.connect(udp=True)
+
+        expectation = server_conn.expect('BIG_MESSAGE')
+        client_conn.send(self.big_message)
+        server_conn.receive(expectation, 100)
+        server_conn.send(self.big_message)
+
+        self.assertTrue(wait_until(lambda: 9915 in server_conn.stats()['rx']['by_id']))
+        stats = server_conn.stats()
+        self.assertEqual(stats['rx']['by_id'][9915]['messages'], 1)
+        self.assertGreater(stats['rx']['by_id'][9915]['bytes'], 12)
+        self.assertEqual(stats['tx']['by_id'][9915]['messages'], 1)
+        self.assertGreaterEqual(stats['rx']['messages'], 1)
+        self.assertEqual(len(stats['senders']), 1)
+        self.assertEqual(list(stats['senders'].values())[0]['lost'], 0)
+
+    def testSequenceTracking(self):
+        port = free_port(socket.SOCK_DGRAM)
+        server_physical = libmav.UDPServer(port)
+        server_runtime = libmav.NetworkRuntime(self.message_set, self.heartbeat, server_physical)
+        with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+            sock.sendto(heartbeat_frame(0, 2), ('127.0.0.1', port))
+            server_conn = server_runtime.await_connection(2000)
+            # a gap, its late frame, a duplicate, another gap, then a restart of the sequence
+            for seq in [0, 1, 3, 2, 2, 5, 0, 1, 2]:
+                sock.sendto(heartbeat_frame(seq, 1), ('127.0.0.1', port))
+            sender = lambda: server_conn.stats()['senders'].get((1, 1), {})
+            self.assertTrue(wait_until(lambda: sender().get('received', 0) >= 9))
+
+        self.assertEqual(sender()['received'], 9)
+        self.assertEqual(sender()['lost'], 1)
+        self.assertEqual(sender()['duplicates'], 1)
+        self.assertEqual(sender()['reordered'], 1)
+        self.assertEqual(sender()['resets'], 1)
+
+    def testLatest(self):
+        server_conn, client_conn = self.connect(udp=True)
+
+        expectation = server_conn.expect('BIG_MESSAGE')
+        client_conn.send(self.big_message)
+        server_conn.receive(expectation, 100)
+
+        self.assertTrue(wait_until(lambda: server_conn.latest('BIG_MESSAGE') is not None))
+        self.assertEqual(self.big_message.to_dict(), server_conn.latest('BIG_MESSAGE').to_dict())
+        self.assertEqual(self.big_message.to_dict(), server_conn.latest(9915).to_dict())
+        self.assertIsNone(server_conn.latest('BIG_MESSAGE', 123, 45))
+        self.assertIsNone(server_conn.latest('OTHER_MESSAGE'))
+
+    def testBatchCallback(self):
+        server_conn, client_conn = self.connect()
+
+        batches = []
+        handle = client_conn.add_batch_callback(batches.append, 8, 50)
+        for _ in range(20):
+            server_conn.send(self.big_message)
+        received = lambda: [msg for batch in batches for msg in batch if msg.name == 'BIG_MESSAGE']
+        self.assertTrue(wait_until(lambda: len(received()) >= 20))
+        client_conn.remove_message_callback(handle)
+
+        self.assertEqual(len(received()), 20)
+        self.assertTrue(all(len(batch) <= 8 for batch in batches))
+
+        # a partial batch is delivered when the callback is removed
+        batches = []
+        handle = client_conn.add_batch_callback(batches.append, 100, 60000)
+        seen = []
+        seen_handle = client_conn.add_message_callback(lambda msg: msg.name == 'BIG_MESSAGE' and seen.append(msg))
+        for _ in range(3):
+            server_conn.send(self.big_message)
+        self.assertTrue(wait_until(lambda: len(seen) >= 3))
+        client_conn.remove_message_callback(seen_handle)
+        client_conn.remove_message_callback(handle)
+        self.assertEqual(len(received()), 3)
+
+        executor = libmav.CallbackExecutor(2)
+        ordered = []
+        handle = client_conn.add_message_callback(ordered.append, executor, 'message_id')
+        for i in range(20):
+            self.big_message['uint8_field'] = i
+            server_conn.send(self.big_message)
+        received = lambda: [msg['uint8_field'] for msg in ordered if msg.name == 'BIG_MESSAGE']
+        self.assertTrue(wait_until(lambda: len(received()) >= 20 and len(executor) == 0))
+        client_conn.remove_message_callback(handle)
+
+        self.assertEqual(received(), list(range(20)))
+
+        # the two ends of a link are consecutive connections, and so run on different workers
+        threads = {}
+        handles = [conn.add_message_callback(lambda msg, name=name: threads.setdefault(name, threading.get_ident()),
+                                             executor, 'connection')
+                   for name, conn in [('server', server_conn), ('client', client_conn)]]
+        server_conn.send(self.big_message)
+        client_conn.send(self.big_message)
+        self.assertTrue(wait_until(lambda: len(threads) == 2))
+        for conn, handle in zip([server_conn, client_conn], handles):
+            conn.remove_message_callback(handle)
+        self.assertNotEqual(threads['server'], threads['client'])
+        self.assertEqual(executor.dropped, 0)
+
+    def testRouter(self):
+        # a stream link to the vehicle, as a serial autopilot would be, and a UDP link to the GCS
+        gcs = self.link(libmav.Identifier(255, 190), udp=True)
+        vehicle = self.link(libmav.Identifier(1, 1))
+
+        router = libmav.Router()
+        self.assertEqual(router.add_link(gcs.server_physical, gcs.server_conn), 0)
+        self.assertEqual(router.add_link(vehicle.server_physical, vehicle.server_conn), 1)
+
+        expectation = vehicle.client_conn.expect('BIG_MESSAGE', 255, 190)
+        gcs.client_conn.send(self.big_message)
+        message = vehicle.client_conn.receive(expectation, 1000)
+        self.assertEqual(self.big_message.to_dict(), message.to_dict())
+        self.assertEqual(router.routes()[(255, 190)], [0])
+        self.assertGreaterEqual(router.stats()[1]['sent'], 1)
+
+        # forwarded frames share the send lock of the runtime, so none is torn by its own traffic
+        received = []
+        vehicle.client_conn.add_message_callback(
+            lambda msg: received.append(msg) if msg.name == 'BIG_MESSAGE' else None)
+        for i in range(50):
+            self.big_message['uint8_field'] = i
+            gcs.client_conn.send(self.big_message)
+            vehicle.server_conn.send(self.big_message)
+        self.assertTrue(wait_until(lambda: len(received) >= 100))
+        time.sleep(0.1)
+        self.assertEqual(len(received), 100)
+
+        with self.assertRaises(ValueError):
+            router.add_link(gcs.server_physical, vehicle.server_conn)
+
+    def testRedundantLinkGroup(self):
+        # the router copies every vehicle frame, unchanged, onto two links
+        router = libmav.Router()
+        links = [self.link(libmav.Identifier(1 if i == 0 else 255, 1)) for i in range(3)]
+        for link in links:
+            router.add_link(link.server_physical, link.server_conn)
+        vehicle_conn = links[0].client_conn
+
+        group = libmav.RedundantLinkGroup([link.client_conn for link in links[1:]])
+        received = []
+        handle = group.add_message_callback(received.append)
+        # callbacks run unlocked, so one can remove itself
+        once = []
+        registered = threading.Event()
+        def first_only(msg):
+            registered.wait()
+            once.append(msg)
+            group.remove_message_callback(once_handle)
+        once_handle = group.add_message_callback(first_only)
+        registered.set()
+        for i in range(5):
+            self.big_message['uint8_field'] = i
+            vehicle_conn.send(self.big_message)
+        big_messages = lambda: [msg['uint8_field'] for msg in received if msg.name == 'BIG_MESSAGE']
+        stats = group.stats
+        self.assertTrue(wait_until(lambda: len(big_messages()) >= 5 and
+                                   sum(link['duplicates'] for link in stats()) >= 5))
+        group.remove_message_callback(handle)
+
+        self.assertEqual(big_messages(), list(range(5)))
+        self.assertEqual(len(once), 1)
+        self.assertGreaterEqual(sum(link['first'] for link in stats()), 5)
+        self.assertIn(group.fastest, [0, 1])
+
+    def testCommand(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        # drops the first transmission, then reports progress before accepting
+        confirmations = []
+        def vehicle(msg):
+            if msg.name != 'COMMAND_LONG':
+                return
+            confirmations.append(msg['confirmation'])
+            if msg['confirmation'] == 0:
+                return
+            for result in [5, 0]:
+                client_conn.send(self.message_set.create('COMMAND_ACK').set_from_dict({
+                    'command': msg['command'],
+                    'result': result
+                }))
+        handle = client_conn.add_message_callback(vehicle)
+
+        command = self.message_set.create('COMMAND_LONG').set_from_dict({
+            'target_system': 1,
+            'target_component': 1,
+            'command': 400,
+            'param1': 1.0
+        })
+        ack = server_conn.command(command, retries=2, timeout_ms=300)
+        self.assertEqual(ack['result'], 0)
+        self.assertEqual(ack['command'], 400)
+        self.assertEqual(confirmations, [0, 1])
+
+        client_conn.remove_message_callback(handle)
+        with self.assertRaises(RuntimeError):
+            server_conn.command(command, retries=1, timeout_ms=100)
+
+        # reports progress once and goes quiet: the command is executing, so it must not be resent
+        received = []
+        def executing(msg):
+            if msg.name != 'COMMAND_LONG':
+                return
+            received.append(msg['confirmation'])
+            client_conn.send(self.message_set.create('COMMAND_ACK').set_from_dict({
+                'command': msg['command'],
+                'result': 5
+            }))
+        client_conn.add_message_callback(executing)
+        with self.assertRaises(libmav.TimeoutException):
+            server_conn.command(command, retries=2, timeout_ms=100)
+        time.sleep(0.1)
+        self.assertEqual(received, [0])
+
+    def testParamClient(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        # loses PARAM_3 from the list, so that it has to be requested on its own
+        def param_value(index):
+            msg = self.message_set.create('PARAM_VALUE').set_from_dict({
+                'param_id': 'PARAM_{}'.format(index),
+                'param_type': 6 if index == 0 else 9,
+                'param_count': 20,
+                'param_index': index
+            })
+            if index == 0:
+                msg.set_as_float_pack('param_value', -42)
+            else:
+                msg['param_value'] = index / 2
+            return msg
+        def vehicle(msg):
+            if msg.name == 'PARAM_REQUEST_LIST':
+                for index in range(20):
+                    if index != 3:
+                        client_conn.send(param_value(index))
+            elif msg.name == 'PARAM_REQUEST_READ':
+                client_conn.send(param_value(msg['param_index']))
+        handle = client_conn.add_message_callback(vehicle)
+
+        params = libmav.ParamClient(server_conn, self.message_set, 1, 1).fetch_all(timeout_ms=200)
+        self.assertEqual(len(params), 20)
+        self.assertEqual(params['PARAM_0'], -42)
+        self.assertEqual(params['PARAM_3'], 1.5)
+        client_conn.remove_message_callback(handle)
+
+        # loses all but PARAM_0 and answers requests late, so they would pile up if they were not paced
+        lock = threading.Lock()
+        pending = []
+        peak = [0]
+        def answer():
+            with lock:
+                batch = list(pending)
+                pending.clear()
+            for index in batch:
+                client_conn.send(param_value(index))
+        def slow_vehicle(msg):
+            if msg.name == 'PARAM_REQUEST_LIST':
+                client_conn.send(param_value(0))
+            elif msg.name == 'PARAM_REQUEST_READ':
+                with lock:
+                    pending.append(msg['param_index'])
+                    peak[0] = max(peak[0], len(pending))
+                threading.Timer(0.02, answer).start()
+        client_conn.add_message_callback(slow_vehicle)
+
+        client = libmav.ParamClient(server_conn, self.message_set, 1, 1)
+        params = client.fetch_all(timeout_ms=200, max_in_flight=3)
+        self.assertEqual(len(params), 20)
+        self.assertLessEqual(peak[0], 3)
+        with self.assertRaises(ValueError):
+            client.fetch_all(max_in_flight=0)
+
+    def testMissionClient(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        stored = {}
+        def request(seq):
+            client_conn.send(self.message_set.create('MISSION_REQUEST_INT').set_from_dict({'seq': seq}))
+        def vehicle(msg):
+            if msg.name == 'MISSION_COUNT':
+                stored['count'] = msg['count']
+                stored['items'] = []
+                request(0)
+            elif msg.name == 'MISSION_ITEM_INT':
+                if msg['seq'] == len(stored['items']):
+                    stored['items'].append(msg.to_dict())
+                if len(stored['items']) < stored['count']:
+                    request(len(stored['items']))
+                else:
+                    client_conn.send(self.message_set.create('MISSION_ACK').set_from_dict({'type': 0}))
+            elif msg.name == 'MISSION_REQUEST_LIST':
+                client_conn.send(self.message_set.create('MISSION_COUNT').set_from_dict({'count': stored['count']}))
+            elif msg.name == 'MISSION_REQUEST_INT':
+                client_conn.send(self.message_set.create('MISSION_ITEM_INT').set_from_dict(stored['items'][msg['seq']]))
+        client_conn.add_message_callback(vehicle)
+
+        items = {
+            'command': [16] * 50,
+            'frame': [6] * 50,
+            'x': [473977420 + i for i in range(50)],
+            'y': [85455940 - i for i in range(50)],
+            'z': [10.0 + i for i in range(50)]
+        }
+        progress = []
+        client = libmav.MissionClient(server_conn, self.message_set, 1, 1)
+        with self.assertRaises(ValueError):
+            client.upload({'comand': [16], 'x': [1]}, timeout_ms=300)
+        with self.assertRaises(ValueError):
+            client.upload({'command': [], 'x': [1]}, timeout_ms=300)
+        time.sleep(0.1)
+        self.assertNotIn('count', stored)
+
+        client.upload(items, progress=lambda done, total: progress.append((done, total)), timeout_ms=300)
+        self.assertEqual(len(stored['items']), 50)
+        self.assertEqual(progress[-1], (50, 50))
+
+        downloaded = client.download(timeout_ms=300)
+        for field, column in items.items():
+            self.assertEqual(downloaded[field], column)
+        self.assertEqual(downloaded['autocontinue'], [0] * 50)
+
+    def testFtpClient(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        contents = bytes(i % 251 for i in range(1000))
+        def reply(request, offset, data, burst_complete=0):
+            payload = [0] * 251
+            payload[0:2] = list(((request[0] | request[1] << 8) + 1).to_bytes(2, 'little'))
+            payload[2:8] = [1, 128, len(data), request[3], burst_complete, 0]
+            payload[8:12] = list(offset.to_bytes(4, 'little'))
+            payload[12:12 + len(data)] = list(data)
+            msg = self.message_set.create('FILE_TRANSFER_PROTOCOL')
+            msg['payload'] = payload
+            client_conn.send(msg)
+        # loses the second chunk of every burst, so that it has to be read again
+        stuck = [False]
+        def vehicle(msg):
+            if msg.name != 'FILE_TRANSFER_PROTOCOL':
+                return
+            request = msg['payload']
+            offset = int.from_bytes(bytes(request[8:12]), 'little')
+            if request[3] == 4:
+                reply(request, 0, len(contents).to_bytes(4, 'little'))
+            elif request[3] == 15:
+                for chunk_offset in range(offset, len(contents), 239):
+                    if chunk_offset != offset + 239:
+                        reply(request, chunk_offset, contents[chunk_offset:chunk_offset + 239],
+                              int(chunk_offset + 239 >= len(contents)))
+            elif request[3] == 5:
+                reply(request, offset, b'' if stuck[0] else contents[offset:offset + request[4]])
+        client_conn.add_message_callback(vehicle)
+
+        client = libmav.FtpClient(server_conn, self.message_set, 1, 1)
+        self.assertEqual(client.read('/fs/microsd/test.bin', timeout_ms=300), contents)
+        buffer = bytearray(2000)
+        self.assertEqual(client.read_into('/fs/microsd/test.bin', buffer, timeout_ms=300), 1000)
+        self.assertEqual(bytes(buffer[:1000]), contents)
+
+        # answers every read of the lost chunk, but without data
+        stuck[0] = True
+        with self.assertRaises(libmav.TimeoutException):
+            client.read('/fs/microsd/test.bin', timeout_ms=100, retries=2)
+
+    def testLogDownloader(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        contents = bytes(i % 253 for i in range(1000))
+        lost = [180]
+        # loses one chunk the first time it is sent
+        def vehicle(msg):
+            if msg.name == 'LOG_REQUEST_LIST':
+                client_conn.send(self.message_set.create('LOG_ENTRY').set_from_dict({
+                    'id': 1, 'num_logs': 1, 'last_log_num': 1, 'time_utc': 1700000000, 'size': len(contents)
+                }))
+            elif msg.name == 'LOG_REQUEST_DATA':
+                for offset in range(msg['ofs'], min(msg['ofs'] + msg['count'], len(contents)), 90):
+                    if offset in lost:
+                        lost.remove(offset)
+                        continue
+                    chunk = contents[offset:min(offset + 90, msg['ofs'] + msg['count'])]
+                    client_conn.send(self.message_set.create('LOG_DATA').set_from_dict({
+                        'id': 1, 'ofs': offset, 'count': len(chunk), 'data': list(chunk) + [0] * (90 - len(chunk))
+                    }))
+        client_conn.add_message_callback(vehicle)
+
+        downloader = libmav.LogDownloader(server_conn, self.message_set, 1, 1)
+        self.assertEqual(downloader.entries(timeout_ms=300), [{'id': 1, 'time_utc': 1700000000, 'size': 1000}])
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, 'log.ulg')
+            self.assertEqual(downloader.download(1, path, timeout_ms=300), 1000)
+            with open(path, 'rb') as f:
+                self.assertEqual(f.read(), contents)
+
+        # chunks are written at their offset, which a pipe cannot take
+        read_end, write_end = os.pipe()
+        try:
+            with self.assertRaises(ValueError):
+                downloader.download_to_fd(1, write_end)
+        finally:
+            os.close(read_end)
+            os.close(write_end)
+
+    def testTimeSync(self):
+        server_conn, client_conn = self.connect(libmav.Identifier(1, 1))
+
+        # both ends share the host clock, so the offset is about zero
+        answers = []
+        server_conn.add_message_callback(
+            lambda msg: answers.append(msg) if msg.name == 'TIMESYNC' and msg['tc1'] != 0 else None)
+        vehicle_sync = libmav.TimeSync(client_conn, self.message_set, interval_ms=0)
+        time_sync = libmav.TimeSync(server_conn, self.message_set, interval_ms=50)
+        self.assertIsNone(time_sync.offset_ns(1))
+        self.assertTrue(wait_until(lambda: time_sync.estimates().get(1, {}).get('samples', 0) > 3))
+
+        estimate = time_sync.estimates()[1]
+        self.assertLess(abs(estimate['offset_ns']), 5000000)
+        self.assertLess(abs(time_sync.to_host_ns(1, 1000000000) - 1000000000), 5000000)
+        self.assertEqual(vehicle_sync.estimates(), {})
+        # answers go back to the requesting component, the server runtime with its default id
+        self.assertTrue(answers)
+        self.assertTrue(all(msg['target_system'] == 97 and msg['target_component'] == 97 for msg in answers))
+
+    def testEmissionScheduler(self):
+        link = self.link(udp=True)
+        server_conn = link.server_conn
+
+        scheduler = libmav.EmissionScheduler(link.client_physical, tick_us=5000)
+        handles = [scheduler.add(self.heartbeat, 20, libmav.Identifier(100 + i, 1)) for i in range(20)]
+        self.assertEqual(len(scheduler), 20)
+        received = lambda i: server_conn.stats()['senders'].get((100 + i, 1), {}).get('received', 0)
+        self.assertTrue(wait_until(lambda: all(received(i) >= 5 for i in range(20))))
+        for handle in handles:
+            scheduler.remove(handle)
+        self.assertEqual(len(scheduler), 0)
+
+        senders = server_conn.stats()['senders']
+        for i in range(20):
+            self.assertEqual(senders[(100 + i, 1)]['lost'], 0)
+        self.assertEqual(scheduler.stats()['errors'], 0)
+
+        tcp = self.link()
+        with self.assertRaises(ValueError):
+            libmav.EmissionScheduler(tcp.client_physical)
+        with self.assertRaises(ValueError):
+            scheduler.add(self.heartbeat, 1, libmav.Identifier(100, 1), interface=tcp.client_physical)
+
+    def testEmissionSchedulerManyLinks(self):
+        port = free_port(socket.SOCK_DGRAM)
+        server_physical = libmav.UDPServer(port)
+        server_runtime = libmav.NetworkRuntime(self.message_set, self.heartbeat, server_physical)
+        server_connections = []
+        server_runtime.on_connection(server_connections.append)
+
+        # runtimes without a heartbeat message, the scheduler streams the heartbeats of all links
+        client_physicals = [libmav.UDPClient('127.0.0.1', port) for _ in range(3)]
+        client_runtimes = [libmav.NetworkRuntime(self.message_set, physical) for physical in client_physicals]
+
+        scheduler = libmav.EmissionScheduler(client_physicals[0], tick_us=5000)
+        for i, physical in enumerate(client_physicals):
+            scheduler.add(self.heartbeat, 20, libmav.Identifier(200 + i, 1), interface=physical)
+        senders = lambda: sorted(key for conn in list(server_connections) for key in conn.stats()['senders'])
+        self.assertTrue(wait_until(lambda: len(senders()) == 3))
+
+        self.assertEqual(len(server_connections), 3)
+        self.assertEqual(senders(), [(200, 1), (201, 1), (202, 1)])
+        self.assertEqual(scheduler.stats()['errors'], 0)
+
+    def testRateLimitedCallback(self):
+        server_conn, client_conn = self.connect()
+
+        first = []
+        latest = []
+        first_handle = client_conn.add_message_callback(first.append, max_rate_hz=2, keep='first')
+        latest_handle = client_conn.add_message_callback(latest.append, max_rate_hz=2, keep='latest')
+        queue = libmav.MessageQueue(client_conn, rate=2, keep='first')
+        for i in range(20):
+            self.big_message['uint8_field'] = i
+            server_conn.send(self.big_message)
+        # the newest message is handed on once the window of the first one is over
+        self.assertTrue(wait_until(lambda: len([msg for msg in latest if msg.name == 'BIG_MESSAGE']) >= 2))
+        client_conn.remove_message_callback(first_handle)
+        client_conn.remove_message_callback(latest_handle)
+
+        first = [msg for msg in first if msg.name == 'BIG_MESSAGE']
+        latest = [msg for msg in latest if msg.name == 'BIG_MESSAGE']
+        queued = [msg for msg in queue if msg.name == 'BIG_MESSAGE']
+        self.assertEqual([msg['uint8_field'] for msg in first], [0])
+        self.assertEqual([msg['uint8_field'] for msg in queued], [0])
+        self.assertEqual([msg['uint8_field'] for msg in latest], [0, 19])
+
+        # an exception in a callback run by the flush thread does not take the process down
+        calls = []
+        def failing(msg):
+            if msg.name == 'BIG_MESSAGE':
+                calls.append(msg['uint8_field'])
+                # the newest message of the window is the one the flush thread delivers
+                if msg['uint8_field'] == 4:
+                    raise ValueError('callback failed')
+        handle = client_conn.add_message_callback(failing, max_rate_hz=5, keep='latest')
+        for i in range(5):
+            self.big_message['uint8_field'] = i
+            server_conn.send(self.big_message)
+        self.assertTrue(wait_until(lambda: 4 in calls))
+        client_conn.remove_message_callback(handle)
+        self.assertEqual(calls, [0, 4])
+
+    def testSendQueue(self):
+        server_conn, client_conn = self.connect()
+
+        queue = libmav.MessageQueue(client_conn)
+        send_queue = libmav.SendQueue(server_conn, 4)
+        for i in range(10):
+            self.big_message['uint8_field'] = i
+            send_queue.send(self.big_message, 1000)
+        self.assertTrue(send_queue.flush(1000))
+
+        received = [msg['uint8_field'] for msg in collect(queue, 10)]
+        self.assertEqual(received, list(range(10)))
+        stats = send_queue.stats()
+        self.assertEqual(stats['sent'], 10)
+        self.assertEqual(stats['depth'], 0)
+        self.assertLessEqual(stats['high_water'], 4)
+        self.assertIsNone(self.big_message.receive_time_ns)
+        send_queue.send(self.big_message, 1000)
+        self.assertTrue(send_queue.flush(1000))
+        received = collect(queue, 1)
+        self.assertEqual(len(received), 1)
+        self.assertLessEqual(received[0].receive_time_ns, time.monotonic_ns())
+
+        latency = client_conn.latency()['queue']
+        self.assertGreaterEqual(latency['count'], 11)
+        self.assertLessEqual(latency['p50_ns'], latency['max_ns'])
+        self.assertEqual(sum(count for _, count in latency['buckets']), latency['count'])
+
+        send_queue = libmav.SendQueue(server_conn, 100, max_bytes_per_second=2000)
+        for i in range(10):
+            self.big_message['uint8_field'] = i
+            send_queue.send(self.big_message, priority=libmav.SendQueue.PRIORITY_BULK)
+        self.big_message['uint8_field'] = 100
+        send_queue.send(self.big_message, priority=libmav.SendQueue.PRIORITY_HIGH)
+        self.assertTrue(send_queue.flush(5000))
+
+        received = [msg['uint8_field'] for msg in collect(queue, 11)]
+        self.assertEqual(len(received), 11)
+        self.assertLess(received.index(100), 5)
+        self.assertEqual(send_queue.stats()['lanes'][libmav.SendQueue.PRIORITY_BULK]['sent'], 10)
+
+        # a paced queue is not drained on destruction, which would take about 10 s here
+        send_queue = libmav.SendQueue(server_conn, 100, max_bytes_per_second=200)
+        for _ in range(10):
+            send_queue.send(self.big_message)
+        start = time.monotonic()
+        del send_queue
+        self.assertLess(time.monotonic() - start, 1)
+
+    def testAsyncReceive(self):
+        server_conn, client_conn = self.connect()
+
+        async def run():
+            expectation = client_conn.expect_async('BIG_MESSAGE')
+            server_conn.send(self.big_message)
+            response = await asyncio.wait_for(expectation, 1)
+            self.assertEqual(self.big_message.to_dict(), response.to_dict())
+
+            queue = libmav.MessageQueue(client_conn)
+            server_conn.send(self.big_message)
+            response = await asyncio.wait_for(queue.receive_async(), 1)
+            self.assertTrue(response.name in ('BIG_MESSAGE', 'HEARTBEAT'))
+
+            # a receive that timed out must not take a message that arrives afterwards
+            later = libmav.MessageQueue(client_conn)
+            try:
+                await asyncio.wait_for(later.receive_async(), 0.05)
+            except asyncio.TimeoutError:
+                pass
+            server_conn.send(self.big_message)
+            names = []
+            while 'BIG_MESSAGE' not in names:
+                names.append((await asyncio.wait_for(later.receive_async(), 1)).name)
+
+        asyncio.run(run())
+
+        # a match after the loop is closed must not break the receive thread
+        async def abandon():
+            return client_conn.expect_async('BIG_MESSAGE')
+        abandoned = asyncio.run(abandon())
+        server_conn.send(self.big_message)
+        expectation = client_conn.expect('BIG_MESSAGE')
+        server_conn.send(self.big_message)
+        self.assertEqual(self.big_message.to_dict(), client_conn.receive(expectation, 1000).to_dict())
+        self.assertFalse(abandoned.done())
+
 
 if __name__ == '__main__':
     unittest.main()